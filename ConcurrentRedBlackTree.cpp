@@ -0,0 +1,104 @@
+#include "ConcurrentRedBlackTree.h"
+#include <stdexcept> // for exceptions
+#include <thread> // for yield
+
+// Even the biggest tree we can address is shorter than this, so a search
+// that goes deeper raced a writer
+static const int MAX_SEARCH_STEPS = 128;
+
+void ConcurrentRedBlackTree::Insert(int newData) {
+    if (!TryInsert(newData)) {
+        throw std::invalid_argument("Duplicate value insertion is not allowed.");
+    }
+}
+
+bool ConcurrentRedBlackTree::TryInsert(int newData) {
+    WriteScope write(*this);
+    return tree.TryInsert(newData);
+}
+
+bool ConcurrentRedBlackTree::Remove(int data) {
+    WriteScope write(*this);
+    return tree.Remove(data);
+}
+
+// Version goes odd: readers that start now will wait, ones in flight will retry
+void ConcurrentRedBlackTree::BeginWrite() {
+    version.store(version.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+// Version goes even again and publishes everything the write changed
+void ConcurrentRedBlackTree::EndWrite() {
+    numItems.store(tree.numItems, memory_order_relaxed);
+    version.store(version.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+// Runs read (which returns false if it noticed it's looking at a mess) until
+// it gets through without a write happening at the same time
+template <typename Read>
+void ConcurrentRedBlackTree::OptimisticRead(Read read) const {
+    while (true) {
+        unsigned long long before = version.load(memory_order_acquire);
+        if ((before & 1) == 0) {
+            bool finished = read();
+            atomic_thread_fence(memory_order_acquire);
+            if (finished && version.load(memory_order_relaxed) == before) {
+                return;
+            }
+        }
+        readRetries.fetch_add(1, memory_order_relaxed);
+        this_thread::yield(); // Give the writer a moment to finish
+    }
+}
+
+bool ConcurrentRedBlackTree::Contains(int data) const {
+    bool found = false;
+    OptimisticRead([&]() {
+        found = false;
+        const RBTNode *current = LoadShared(tree.root);
+        for (int steps = 0; current != nullptr; steps++) {
+            if (steps == MAX_SEARCH_STEPS) {
+                return false; // Went around in circles, must have raced a rotation
+            }
+            int key = LoadShared(current->data);
+            if (data == key) {
+                found = true;
+                return true;
+            }
+            current = data < key ? LoadShared(current->left) : LoadShared(current->right);
+        }
+        return true;
+    });
+    return found;
+}
+
+int ConcurrentRedBlackTree::GetMin() const {
+    int data;
+    if (!GetExtreme(true, data)) {
+        throw std::runtime_error("Red Black Tree is empty");
+    }
+    return data;
+}
+
+int ConcurrentRedBlackTree::GetMax() const {
+    int data;
+    if (!GetExtreme(false, data)) {
+        throw std::runtime_error("Red Black Tree is empty");
+    }
+    return data;
+}
+
+// Reads the cached leftmost or rightmost key; false if the tree is empty
+bool ConcurrentRedBlackTree::GetExtreme(bool smallest, int &data) const {
+    bool any = false;
+    OptimisticRead([&]() {
+        const RBTNode *node = LoadShared(smallest ? tree.leftmost : tree.rightmost);
+        any = node != nullptr;
+        if (any) {
+            data = LoadShared(node->data);
+        }
+        return true;
+    });
+    return any;
+}
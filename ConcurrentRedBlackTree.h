@@ -0,0 +1,74 @@
+#ifndef CONCURRENTREDBLACKTREE_H
+#define CONCURRENTREDBLACKTREE_H
+
+#include <atomic>
+#include <mutex>
+#include "RedBlackTree.h"
+
+using namespace std;
+
+// A RedBlackTree that any number of reader threads can use while one writer
+// keeps changing it.
+//
+// Writers take a mutex (so several writers just queue up) and bump a version
+// counter before and after every change, so the version is odd while the tree
+// is being changed. Readers never lock: they note the version, search the
+// tree, and keep the answer only if the version didn't move in between
+// (a seqlock). A reader that raced a writer just tries again, so readers never
+// hold up the writer.
+//
+// Every word a reader looks at (the root, the cached ends, links and keys) is
+// written with StoreShared and read with LoadShared (see RedBlackCore.h), so
+// a racing read gets a stale value, never a torn one.
+// A racing reader can see half-rotated nodes, so its search is capped at the
+// tallest possible tree height. Node memory stays valid for the whole life of
+// the tree: removed nodes go back to the pool's free list, and the pool only
+// gives slabs back when the tree is destroyed.
+class ConcurrentRedBlackTree {
+
+	public:
+		ConcurrentRedBlackTree() {}
+		ConcurrentRedBlackTree(const ConcurrentRedBlackTree &) = delete;
+		ConcurrentRedBlackTree &operator=(const ConcurrentRedBlackTree &) = delete;
+
+		// Writer side, same behavior as RedBlackTree
+		void Insert(int newData);
+		bool TryInsert(int newData);
+		bool Remove(int data);
+
+		// Reader side, safe to call from any thread at any time
+		bool Contains(int data) const;
+		int GetMin() const;
+		int GetMax() const;
+		size_t Size() const { return numItems.load(memory_order_acquire); }
+
+		// How many optimistic reads had to be retried because a write got in the way
+		unsigned long long ReadRetries() const { return readRetries.load(memory_order_relaxed); }
+
+	private:
+		RedBlackTree tree;
+		mutex writeLock;
+		atomic<unsigned long long> version{0};
+		atomic<size_t> numItems{0};
+		mutable atomic<unsigned long long> readRetries{0};
+
+		void BeginWrite();
+		void EndWrite();
+
+		// Holds the write lock with the version odd for as long as it lives.
+		// EndWrite runs even if the write throws, or readers would wait forever.
+		class WriteScope {
+			public:
+				WriteScope(ConcurrentRedBlackTree &owner) : owner(owner), guard(owner.writeLock) { owner.BeginWrite(); }
+				~WriteScope() { owner.EndWrite(); }
+			private:
+				ConcurrentRedBlackTree &owner;
+				lock_guard<mutex> guard;
+		};
+
+		bool GetExtreme(bool smallest, int &data) const;
+		template <typename Read>
+		void OptimisticRead(Read read) const;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include "FrozenRedBlackTree.h"
+
+bool FrozenRedBlackTree::Contains(int data) const {
+    size_t k = LowerBoundIndex(data);
+    return k != 0 && keys[k] == data;
+}
+
+bool FrozenRedBlackTree::LowerBound(int data, int &result) const {
+    size_t k = LowerBoundIndex(data);
+    if (k == 0) {
+        return false;
+    }
+    result = keys[k];
+    return true;
+}
+
+// Index of the first key >= data, or 0 if every key is smaller.
+// The loop has no branch on the compare: it always walks all the way down,
+// going right when the key is too small. Going right sets a 1 bit, going
+// left a 0, so the last time we went left is the lowest 0 bit of k, and
+// the answer is k with that bit and everything below it shifted off.
+size_t FrozenRedBlackTree::LowerBoundIndex(int data) const {
+    const size_t n = keys.size();
+    const int *base = keys.data();
+    size_t k = 1;
+    while (k < n) {
+        // 16 levels down is 16 * k, one cache line of keys four levels ahead
+        __builtin_prefetch(base + 16 * k);
+        k = 2 * k + (base[k] < data);
+    }
+    k >>= __builtin_ctzll(~k) + 1;
+    return k;
+}
+
+int FrozenRedBlackTree::GetMin() const {
+    if (Size() == 0) {
+        throw std::runtime_error("Red Black Tree is empty");
+    }
+    return keys[FirstIndex()];
+}
+
+int FrozenRedBlackTree::GetMax() const {
+    if (Size() == 0) {
+        throw std::runtime_error("Red Black Tree is empty");
+    }
+    size_t k = 1;
+    while (2 * k + 1 < keys.size()) k = 2 * k + 1;
+    return keys[k];
+}
+
+RedBlackTree FrozenRedBlackTree::Thaw() const {
+    vector<int> sorted;
+    sorted.reserve(Size());
+    for (size_t k = FirstIndex(); k != 0; k = NextIndex(k)) {
+        sorted.push_back(keys[k]);
+    }
+    return RedBlackTree::BuildFromSorted(sorted.begin(), sorted.end());
+}
+
+// Leftmost index, or 0 if empty
+size_t FrozenRedBlackTree::FirstIndex() const {
+    if (Size() == 0) return 0;
+    size_t k = 1;
+    while (2 * k < keys.size()) k = 2 * k;
+    return k;
+}
+
+// In-order successor of index k, or 0 after the last key
+size_t FrozenRedBlackTree::NextIndex(size_t k) const {
+    if (2 * k + 1 < keys.size()) {
+        // Leftmost index of the right subtree
+        k = 2 * k + 1;
+        while (2 * k < keys.size()) k = 2 * k;
+        return k;
+    }
+    // Climb while we're a right child; the parent of the last left child is next
+    while (k & 1) k >>= 1;
+    return k >> 1;
+}
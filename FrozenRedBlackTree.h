@@ -0,0 +1,69 @@
+#ifndef FROZENREDBLACKTREE_H
+#define FROZENREDBLACKTREE_H
+
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+#include "RedBlackTree.h"
+
+using namespace std;
+
+// Read-only copy of a RedBlackTree packed into one array, made by
+// RedBlackTree::Freeze().
+//
+// The keys are stored in Eytzinger (BFS) order: the root is at index 1 and
+// the children of index k are at 2k and 2k + 1. A search is then just index
+// math over one contiguous array with no pointers to chase, the top levels of
+// the tree share a handful of cache lines, and the next levels can be
+// prefetched before the compare that needs them is done. Thaw() turns it back
+// into a normal tree that can be changed again.
+class FrozenRedBlackTree {
+
+	public:
+		FrozenRedBlackTree() : keys(1) {}
+		// Keys have to be strictly increasing, like BuildFromSorted
+		template <typename It>
+		FrozenRedBlackTree(It first, It last);
+
+		bool Contains(int data) const;
+		// Sets result to the first key >= data; false if there isn't one
+		bool LowerBound(int data, int &result) const;
+		int GetMin() const;
+		int GetMax() const;
+		size_t Size() const { return keys.size() - 1; }
+
+		// Mutable tree with the same keys, built in O(n)
+		RedBlackTree Thaw() const;
+
+	private:
+		vector<int> keys; // keys[0] is unused so the index math stays simple
+
+		size_t LowerBoundIndex(int data) const;
+		template <typename It>
+		void Fill(size_t k, It &next, const int *&previous);
+		size_t FirstIndex() const;
+		size_t NextIndex(size_t k) const;
+};
+
+template <typename It>
+FrozenRedBlackTree::FrozenRedBlackTree(It first, It last) {
+	keys.resize(distance(first, last) + 1);
+	const int *previous = nullptr;
+	Fill(1, first, previous);
+}
+
+// Hands out the sorted keys in order to an in-order walk of the implicit tree
+template <typename It>
+void FrozenRedBlackTree::Fill(size_t k, It &next, const int *&previous) {
+	if (k >= keys.size()) return;
+	Fill(2 * k, next, previous);
+	keys[k] = *next;
+	++next;
+	if (previous != nullptr && *previous >= keys[k]) {
+		throw invalid_argument("FrozenRedBlackTree needs strictly increasing keys");
+	}
+	previous = &keys[k];
+	Fill(2 * k + 1, next, previous);
+}
+
+#endif
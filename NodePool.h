@@ -0,0 +1,196 @@
+#ifndef NODEPOOL_H
+#define NODEPOOL_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// Slab allocator for tree nodes.
+// Nodes are handed out from big contiguous blocks (slabs) and freed nodes go
+// on a free list so the next Allocate() reuses them. Release() gives back
+// every slab at once, so a tree never has to walk itself just to free memory.
+// A pool can also keep other pools' slabs alive (Adopt) when their nodes
+// move into its tree.
+//
+// Allocate() only hands out raw storage; the caller constructs the node in it
+// (placement new) and destroys it before calling Free().
+template <typename Node, typename Alloc = allocator<Node>>
+class BasicNodePool {
+
+	public:
+		BasicNodePool() {}
+		BasicNodePool(const BasicNodePool &) = delete;
+		BasicNodePool &operator=(const BasicNodePool &) = delete;
+		BasicNodePool(BasicNodePool &&other) noexcept { Steal(other); }
+		BasicNodePool &operator=(BasicNodePool &&other) noexcept {
+			if (this != &other) {
+				Release();
+				Steal(other);
+			}
+			return *this;
+		}
+		~BasicNodePool() { Release(); }
+
+		// Storage for one node, from the free list if possible
+		Node *Allocate() {
+			if (freeList != nullptr) {
+				Slot *slot = freeList;
+				freeList = slot->next;
+				return reinterpret_cast<Node *>(slot->storage);
+			}
+			if (nextSlot == slabEnd) {
+				AddSlab(nextSlabSize);
+				if (nextSlabSize < MAX_SLAB_NODES) nextSlabSize *= 2;
+			}
+			return reinterpret_cast<Node *>((nextSlot++)->storage);
+		}
+
+		// Storage for count nodes laid out next to each other
+		Node *AllocateBlock(size_t count) {
+			static_assert(sizeof(Slot) == sizeof(Node), "blocks are only contiguous nodes if a node is at least pointer sized");
+			if (count == 0) return nullptr;
+			if (size_t(slabEnd - nextSlot) < count) {
+				AddSlab(count > nextSlabSize ? count : nextSlabSize);
+			}
+			Slot *block = nextSlot;
+			nextSlot += count;
+			return reinterpret_cast<Node *>(block->storage);
+		}
+
+		// Puts a (already destroyed) node back on the free list. The link goes
+		// in with an atomic store since a ConcurrentRedBlackTree reader can
+		// still be reading the old node.
+		void Free(Node *node) {
+			Slot *slot = reinterpret_cast<Slot *>(node);
+			__atomic_store_n(&slot->next, freeList, __ATOMIC_RELAXED);
+			freeList = slot;
+		}
+
+		// Makes sure the next count Allocate() calls don't need another slab.
+		// Small reservations still get a full size slab, or a stream of small
+		// batches would leave a trail of tiny ones.
+		void Reserve(size_t count) {
+			if (size_t(slabEnd - nextSlot) < count) {
+				AddSlab(count > nextSlabSize ? count : nextSlabSize);
+				if (count <= nextSlabSize && nextSlabSize < MAX_SLAB_NODES) nextSlabSize *= 2;
+			}
+		}
+
+		// Keeps other's slabs, and every slab other keeps alive, around as long
+		// as this pool is, so nodes that came from other can be linked into a
+		// tree that allocates from this pool. Adopted slabs sit in one flat list
+		// without repeats and never point back at a pool, so adopting can't
+		// build chains or cycles.
+		void Adopt(const BasicNodePool &other) {
+			if (other.slabs != nullptr) AddAdopted(other.slabs);
+			for (const shared_ptr<SlabSet> &set : other.adopted) {
+				AddAdopted(set);
+			}
+		}
+
+		// True if this pool already keeps alive every slab other does
+		bool Holds(const BasicNodePool &other) const {
+			if (other.slabs != nullptr && !Keeps(other.slabs.get())) return false;
+			for (const shared_ptr<SlabSet> &set : other.adopted) {
+				if (!Keeps(set.get())) return false;
+			}
+			return true;
+		}
+
+		// Lets go of every slab at once (slabs another pool adopted stay until
+		// that pool is done with them)
+		void Release() {
+			slabs.reset();
+			adopted.clear();
+			freeList = nextSlot = slabEnd = nullptr;
+			nextSlabSize = MIN_SLAB_NODES;
+		}
+
+		// Total nodes the pool has room for (handed out or not)
+		size_t Capacity() const {
+			size_t total = 0;
+			if (slabs != nullptr) {
+				for (const Slab &slab : slabs->list) total += slab.second;
+			}
+			return total;
+		}
+
+	private:
+		static const size_t MIN_SLAB_NODES = 64;
+		static const size_t MAX_SLAB_NODES = 65536;
+
+		union Slot {
+			Slot *next;
+			alignas(Node) unsigned char storage[sizeof(Node)];
+		};
+
+		typedef typename allocator_traits<Alloc>::template rebind_alloc<Slot> SlotAlloc;
+		typedef allocator_traits<SlotAlloc> SlotTraits;
+		typedef pair<Slot *, size_t> Slab;
+
+		// One pool's slabs, shared with every pool that adopted them and given
+		// back when the last of those lets go
+		struct SlabSet {
+			SlotAlloc slotAlloc;
+			vector<Slab> list;
+			~SlabSet() {
+				for (const Slab &slab : list) {
+					SlotTraits::deallocate(slotAlloc, slab.first, slab.second);
+				}
+			}
+		};
+
+		shared_ptr<SlabSet> slabs; // made by the first AddSlab
+		vector<shared_ptr<SlabSet>> adopted;
+		Slot *freeList = nullptr;
+		Slot *nextSlot = nullptr;  // next never-used slot in the newest slab
+		Slot *slabEnd = nullptr;
+		size_t nextSlabSize = MIN_SLAB_NODES;
+
+		bool Keeps(const SlabSet *set) const {
+			if (set == slabs.get()) return true;
+			for (const shared_ptr<SlabSet> &mine : adopted) {
+				if (mine.get() == set) return true;
+			}
+			return false;
+		}
+
+		void AddAdopted(const shared_ptr<SlabSet> &set) {
+			if (!Keeps(set.get())) adopted.push_back(set);
+		}
+
+		void AddSlab(size_t count) {
+			// Whatever is left of the old slab goes on the free list so it isn't wasted
+			while (nextSlot != slabEnd) {
+				nextSlot->next = freeList;
+				freeList = nextSlot++;
+			}
+			if (slabs == nullptr) slabs = make_shared<SlabSet>();
+			Slot *slab = SlotTraits::allocate(slabs->slotAlloc, count);
+			try {
+				slabs->list.push_back(Slab(slab, count));
+			} catch (...) {
+				SlotTraits::deallocate(slabs->slotAlloc, slab, count);
+				throw;
+			}
+			nextSlot = slab;
+			slabEnd = slab + count;
+		}
+
+		void Steal(BasicNodePool &other) {
+			slabs = std::move(other.slabs);
+			adopted = std::move(other.adopted);
+			freeList = other.freeList;
+			nextSlot = other.nextSlot;
+			slabEnd = other.slabEnd;
+			nextSlabSize = other.nextSlabSize;
+			other.slabs.reset();
+			other.adopted.clear();
+			other.freeList = other.nextSlot = other.slabEnd = nullptr;
+			other.nextSlabSize = MIN_SLAB_NODES;
+		}
+};
+
+#endif
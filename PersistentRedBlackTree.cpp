@@ -0,0 +1,153 @@
+#include "PersistentRedBlackTree.h"
+#include <stdexcept> // for exceptions
+#include <vector>
+
+void PersistentRedBlackTree::Insert(int newData) {
+    if (!TryInsert(newData)) {
+        throw std::invalid_argument("Duplicate value insertion is not allowed.");
+    }
+}
+
+bool PersistentRedBlackTree::TryInsert(int newData) {
+    bool inserted = false;
+    NodePtr newRoot = InsertInto(root, newData, inserted);
+    if (!inserted) {
+        return false;
+    }
+    // Root is always black; that's one more copy if the fixup left it red
+    if (newRoot->color == COLOR_RED) {
+        newRoot = make_shared<const Node>(COLOR_BLACK, newRoot->left, newRoot->data, newRoot->right);
+    }
+    root = std::move(newRoot);
+    numItems++;
+    return true;
+}
+
+// Returns the new version of node with data in it. Only the nodes on the
+// search path get copied; if data is already there nothing is copied at all.
+PersistentRedBlackTree::NodePtr PersistentRedBlackTree::InsertInto(const NodePtr &node, int data, bool &inserted) {
+    if (node == nullptr) {
+        inserted = true;
+        return make_shared<const Node>(COLOR_RED, nullptr, data, nullptr);
+    }
+    if (data < node->data) {
+        NodePtr left = InsertInto(node->left, data, inserted);
+        if (!inserted) return node;
+        return Balance(node->color, std::move(left), node->data, node->right);
+    }
+    if (data > node->data) {
+        NodePtr right = InsertInto(node->right, data, inserted);
+        if (!inserted) return node;
+        return Balance(node->color, node->left, node->data, std::move(right));
+    }
+    return node; // Duplicate
+}
+
+// Builds a node, fixing a red child with a red grandchild under a black node.
+// All four shapes (left-left, left-right, right-left, right-right) turn into
+// the same thing: a red node with two black children.
+PersistentRedBlackTree::NodePtr PersistentRedBlackTree::Balance(unsigned short int color, NodePtr left, int data, NodePtr right) {
+    if (color == COLOR_BLACK) {
+        if (IsRed(left) && IsRed(left->left)) {
+            const Node *l = left.get();
+            return make_shared<const Node>(COLOR_RED,
+                make_shared<const Node>(COLOR_BLACK, l->left->left, l->left->data, l->left->right),
+                l->data,
+                make_shared<const Node>(COLOR_BLACK, l->right, data, std::move(right)));
+        }
+        if (IsRed(left) && IsRed(left->right)) {
+            const Node *l = left.get();
+            const Node *middle = l->right.get();
+            return make_shared<const Node>(COLOR_RED,
+                make_shared<const Node>(COLOR_BLACK, l->left, l->data, middle->left),
+                middle->data,
+                make_shared<const Node>(COLOR_BLACK, middle->right, data, std::move(right)));
+        }
+        if (IsRed(right) && IsRed(right->left)) {
+            const Node *r = right.get();
+            const Node *middle = r->left.get();
+            return make_shared<const Node>(COLOR_RED,
+                make_shared<const Node>(COLOR_BLACK, std::move(left), data, middle->left),
+                middle->data,
+                make_shared<const Node>(COLOR_BLACK, middle->right, r->data, r->right));
+        }
+        if (IsRed(right) && IsRed(right->right)) {
+            const Node *r = right.get();
+            return make_shared<const Node>(COLOR_RED,
+                make_shared<const Node>(COLOR_BLACK, std::move(left), data, r->left),
+                r->data,
+                make_shared<const Node>(COLOR_BLACK, r->right->left, r->right->data, r->right->right));
+        }
+    }
+    return make_shared<const Node>(color, std::move(left), data, std::move(right));
+}
+
+bool PersistentRedBlackTree::Contains(int data) const {
+    const Node *current = root.get();
+    while (current != nullptr) {
+        if (data == current->data) {
+            return true;
+        }
+        current = data < current->data ? current->left.get() : current->right.get();
+    }
+    return false;
+}
+
+int PersistentRedBlackTree::GetMin() const {
+    if (root == nullptr) {
+        throw std::runtime_error("Red Black Tree is empty");
+    }
+    const Node *n = root.get();
+    while (n->left != nullptr) n = n->left.get();
+    return n->data;
+}
+
+int PersistentRedBlackTree::GetMax() const {
+    if (root == nullptr) {
+        throw std::runtime_error("Red Black Tree is empty");
+    }
+    const Node *n = root.get();
+    while (n->right != nullptr) n = n->right.get();
+    return n->data;
+}
+
+// No parent pointers here, so the walks keep their own stack (it never gets
+// deeper than the tree is tall)
+string PersistentRedBlackTree::ToInfixString() const {
+    string result;
+    result.reserve(numItems * RedBlackTree::STRING_CHARS_PER_NODE);
+    vector<const Node *> stack;
+    const Node *n = root.get();
+    while (n != nullptr || !stack.empty()) {
+        while (n != nullptr) {
+            stack.push_back(n);
+            n = n->left.get();
+        }
+        n = stack.back();
+        stack.pop_back();
+        AppendNode(result, n);
+        n = n->right.get();
+    }
+    return result;
+}
+
+string PersistentRedBlackTree::ToPrefixString() const {
+    string result;
+    result.reserve(numItems * RedBlackTree::STRING_CHARS_PER_NODE);
+    vector<const Node *> stack;
+    if (root != nullptr) stack.push_back(root.get());
+    while (!stack.empty()) {
+        const Node *n = stack.back();
+        stack.pop_back();
+        AppendNode(result, n);
+        if (n->right != nullptr) stack.push_back(n->right.get());
+        if (n->left != nullptr) stack.push_back(n->left.get());
+    }
+    return result;
+}
+
+// Same node format as RedBlackTree, without a string per node
+void PersistentRedBlackTree::AppendNode(string &out, const Node *n) {
+    char buffer[RedBlackTree::MAX_NODE_CHARS];
+    out.append(buffer, RedBlackTree::FormatNode(buffer, n->color, n->data) - buffer);
+}
@@ -0,0 +1,66 @@
+#ifndef PERSISTENTREDBLACKTREE_H
+#define PERSISTENTREDBLACKTREE_H
+
+#include <memory>
+#include <string>
+#include "RedBlackTree.h"
+
+using namespace std;
+
+// Red black tree whose nodes never change once built (a persistent tree).
+//
+// Insert copies only the nodes on the path from the root down to the new key
+// and shares every other subtree with the old version, so it costs O(log n)
+// new nodes. That makes Snapshot() just another reference to the current
+// root: O(1), and the snapshot keeps seeing exactly the keys it had no matter
+// what the original does afterwards. Nodes are reference counted and go away
+// when the last version using them does.
+//
+// Since there are no parent pointers, the balancing is done on the way back
+// up the insert path (Okasaki's version of the insert fixup). The reference
+// counts are atomic, so a snapshot can be read on one thread while the
+// original keeps inserting on another.
+class PersistentRedBlackTree {
+
+	public:
+		PersistentRedBlackTree() {}
+
+		// O(1): the copy shares every node with this tree
+		PersistentRedBlackTree Snapshot() const { return *this; }
+
+		void Insert(int newData);
+		bool TryInsert(int newData);
+
+		bool Contains(int data) const;
+		int GetMin() const;
+		int GetMax() const;
+		size_t Size() const { return numItems; }
+
+		// Same " B30 " format as RedBlackTree
+		string ToInfixString() const;
+		string ToPrefixString() const;
+
+	private:
+		struct Node;
+		typedef shared_ptr<const Node> NodePtr;
+
+		struct Node {
+			int data;
+			unsigned short int color;
+			NodePtr left;
+			NodePtr right;
+
+			Node(unsigned short int color, NodePtr left, int data, NodePtr right)
+				: data(data), color(color), left(std::move(left)), right(std::move(right)) {}
+		};
+
+		NodePtr root;
+		size_t numItems = 0;
+
+		static NodePtr InsertInto(const NodePtr &node, int data, bool &inserted);
+		static NodePtr Balance(unsigned short int color, NodePtr left, int data, NodePtr right);
+		static bool IsRed(const NodePtr &node) { return node != nullptr && node->color == COLOR_RED; }
+		static void AppendNode(string &out, const Node *n);
+};
+
+#endif
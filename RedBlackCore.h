@@ -0,0 +1,490 @@
+#ifndef REDBLACKCORE_H
+#define REDBLACKCORE_H
+
+
+#define COLOR_RED 0
+#define COLOR_BLACK 1
+#define COLOR_DOUBLE_BLACK 2
+
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+using namespace std;
+
+
+// The red black tree algorithms that don't care what's stored in a node:
+// rotations, the insert and remove fixups, unlinking, stepping in order,
+// copying and tearing down. RedBlackTree (int keys) and RedBlackMap (any key
+// and value) both run on these, so there is one copy of the balancing code.
+
+
+// Links, keys and the root can be read by ConcurrentRedBlackTree's lock-free
+// readers while the writer changes them, so the writer stores them with these
+// and the readers load them the same way. Relaxed atomics are plain moves on
+// x86; they only stop the compiler from tearing or caching the word.
+template <typename T>
+inline void StoreShared(T &word, type_identity_t<T> value) {
+	__atomic_store_n(&word, value, __ATOMIC_RELAXED);
+}
+
+template <typename T>
+inline T LoadShared(const T &word) {
+	return __atomic_load_n(&word, __ATOMIC_RELAXED);
+}
+
+
+// Picks BasicRBTNode's constructor that writes with StoreShared
+struct shared_init_t { explicit shared_init_t() = default; };
+inline constexpr shared_init_t shared_init{};
+
+
+// Node with a payload of type T (the key for RedBlackTree, the key/value pair
+// for RedBlackMap).
+// Define RBT_COMPACT_NODES to keep the color in the low bits of the parent
+// pointer (nodes are 8 byte aligned, so those bits are always zero). An int
+// node is then just the key, the subtree size and three pointers: 32 bytes
+// instead of 40.
+// Always go through GetParent/SetParent/GetColor/SetColor so both layouts work.
+template <typename T>
+struct BasicRBTNode {
+	T data;
+	unsigned int size = 1; // number of nodes in this subtree, for Select/Rank
+#ifdef RBT_COMPACT_NODES
+	BasicRBTNode *left;
+	BasicRBTNode *right;
+	uintptr_t parentAndColor = 0;
+
+	BasicRBTNode *GetParent() const { return reinterpret_cast<BasicRBTNode *>(parentAndColor & ~COLOR_MASK); }
+	void SetParent(BasicRBTNode *p) { parentAndColor = reinterpret_cast<uintptr_t>(p) | (parentAndColor & COLOR_MASK); }
+	unsigned short int GetColor() const { return (unsigned short int)(parentAndColor & COLOR_MASK); }
+	void SetColor(unsigned short int c) { parentAndColor = (parentAndColor & ~COLOR_MASK) | c; }
+#else
+	unsigned short int color = COLOR_RED;
+	BasicRBTNode *left;
+	BasicRBTNode *right;
+	BasicRBTNode *parent = nullptr;
+
+	BasicRBTNode *GetParent() const { return parent; }
+	void SetParent(BasicRBTNode *p) { parent = p; }
+	unsigned short int GetColor() const { return color; }
+	void SetColor(unsigned short int c) { color = c; }
+#endif
+
+	BasicRBTNode() : data(), left(nullptr), right(nullptr) {}
+	// Builds the payload in place from args
+	template <typename... Args>
+	explicit BasicRBTNode(in_place_t, Args &&...args) : data(std::forward<Args>(args)...), left(nullptr), right(nullptr) {}
+	// Writes the key and links with StoreShared, for a node that a racing
+	// reader may still be looking at from before it was freed
+	BasicRBTNode(shared_init_t, const T &value) {
+		StoreShared(data, value);
+		StoreShared(left, nullptr);
+		StoreShared(right, nullptr);
+	}
+
+#ifdef RBT_COMPACT_NODES
+	private:
+		static const uintptr_t COLOR_MASK = 3; // room for red, black and double black
+#endif
+};
+
+
+// Does nothing; trees that count their rotations and fixup cases pass
+// something with the same member functions instead (see RedBlackTree::Stats)
+struct NoTreeCounters {
+	void LeftRotation() {}
+	void RightRotation() {}
+	void FixupIteration() {}
+	void FixupRecolor() {}
+	void FixupRotation() {}
+};
+
+
+// Every function works on the tree hanging from root, which is passed by
+// reference because rotations and unlinking can change it
+template <typename Node>
+struct RedBlackCore {
+
+	// Null leaves count as black
+	static bool IsBlack(const Node *node) {
+		return node == nullptr || node->GetColor() == COLOR_BLACK;
+	}
+
+	static unsigned int SizeOf(const Node *node) { return node == nullptr ? 0 : node->size; }
+
+	// Rotates the node to the left
+	template <typename Counters>
+	static void LeftRotate(Node *&root, Node *node, Counters counters) {
+		// Set the pivot node to be the right child of the node
+		Node *pivot = node->right;
+		if (pivot == nullptr) return; //If the pivot is null, we can't perform the rotation, so return
+		counters.LeftRotation();
+
+		//Move the right child of the pivot to the left child of the node
+		StoreShared(node->right, pivot->left);
+
+		//If the pivot's left child is not empty, update its parent's pointer
+		if (pivot->left != nullptr) {
+			pivot->left->SetParent(node);
+		}
+
+		//Adjust the parent pointer
+		pivot->SetParent(node->GetParent());
+		//If node has o parent, set the pivot as the root
+		if (node->GetParent() == nullptr) {
+			StoreShared(root, pivot);
+		// If not, adjust the parent's left or right pointer to point to the pivot
+		} else if (node->GetParent()->left == node) {
+			StoreShared(node->GetParent()->left, pivot);
+		} else {
+			StoreShared(node->GetParent()->right, pivot);
+		}
+
+		StoreShared(pivot->left, node); // the node now finally becomes the left child of the pivot
+		node->SetParent(pivot); // the parent of the node is now the pivot
+
+		// The pivot now covers what node used to, node lost the pivot's right side
+		pivot->size = node->size;
+		node->size = 1 + SizeOf(node->left) + SizeOf(node->right);
+	}
+
+	// Rotates the node to the right
+	template <typename Counters>
+	static void RightRotate(Node *&root, Node *node, Counters counters) {
+		//Similarly to left just the inverse
+		Node *pivot = node->left;
+		if (pivot == nullptr) return;
+		counters.RightRotation();
+
+		StoreShared(node->left, pivot->right);
+		if (pivot->right != nullptr) {
+			pivot->right->SetParent(node);
+		}
+
+		pivot->SetParent(node->GetParent());
+		if (node->GetParent() == nullptr) {
+			StoreShared(root, pivot);
+		} else if (node->GetParent()->right == node) {
+			StoreShared(node->GetParent()->right, pivot);
+		} else {
+			StoreShared(node->GetParent()->left, pivot);
+		}
+
+		StoreShared(pivot->right, node);
+		node->SetParent(pivot);
+
+		pivot->size = node->size;
+		node->size = 1 + SizeOf(node->left) + SizeOf(node->right);
+	}
+
+	// Fixes the red-red violation a new red node can cause
+	// Returns true if the root had to be turned black, which makes every path one
+	// black node longer (Join needs to know that)
+	template <typename Counters>
+	static bool InsertFixUp(Node *&root, Node *node, Counters counters) {
+		while (node != root && node->GetParent()->GetColor() == COLOR_RED) {
+			counters.FixupIteration();
+			Node *parent = node->GetParent();
+			Node *grandparent = parent->GetParent();
+			bool parentIsLeft = grandparent->left == parent;
+			Node *uncle = parentIsLeft ? grandparent->right : grandparent->left;
+
+			if (uncle != nullptr && uncle->GetColor() == COLOR_RED) {
+				// Case 1: uncle is red -> recolor and keep going from the grandparent
+				counters.FixupRecolor();
+				parent->SetColor(COLOR_BLACK);
+				uncle->SetColor(COLOR_BLACK);
+				grandparent->SetColor(COLOR_RED);
+				node = grandparent;
+			} else if (parentIsLeft) {
+				if (parent->right == node) {
+					// Case 2: node is right child -> Left Rotate
+					node = parent;
+					LeftRotate(root, node, counters);
+				}
+				// Case 3: node is left child -> Right Rotate
+				counters.FixupRotation();
+				node->GetParent()->SetColor(COLOR_BLACK);
+				grandparent->SetColor(COLOR_RED);
+				RightRotate(root, grandparent, counters);
+			} else {
+				if (parent->left == node) {
+					// Case 2 mirror: node is left child -> Right Rotate
+					node = parent;
+					RightRotate(root, node, counters);
+				}
+				// Case 3 mirror: node is right child -> Left Rotate
+				counters.FixupRotation();
+				node->GetParent()->SetColor(COLOR_BLACK);
+				grandparent->SetColor(COLOR_RED);
+				LeftRotate(root, grandparent, counters);
+			}
+		}
+		bool grew = root->GetColor() == COLOR_RED;
+		root->SetColor(COLOR_BLACK);
+		return grew;
+	}
+
+	// Puts newNode where oldNode is hanging from oldNode's parent
+	static void Transplant(Node *&root, Node *oldNode, Node *newNode) {
+		Node *parent = oldNode->GetParent();
+		if (parent == nullptr) {
+			StoreShared(root, newNode);
+		} else if (parent->left == oldNode) {
+			StoreShared(parent->left, newNode);
+		} else {
+			StoreShared(parent->right, newNode);
+		}
+		if (newNode != nullptr) {
+			newNode->SetParent(parent);
+		}
+	}
+
+	// Takes node out of the tree and fixes the colors and subtree sizes.
+	// The node itself is left alone for the caller to destroy.
+	template <typename Counters>
+	static void Unlink(Node *&root, Node *node, Counters counters) {
+		// Every node above the one that physically leaves the tree loses one
+		// (with two children that's the successor, further down)
+		Node *leaving = node;
+		if (node->left != nullptr && node->right != nullptr) {
+			leaving = node->right;
+			while (leaving->left != nullptr) {
+				leaving = leaving->left;
+			}
+		}
+		for (Node *p = leaving->GetParent(); p != nullptr; p = p->GetParent()) {
+			p->size--;
+		}
+
+		unsigned short int removedColor = node->GetColor();
+		Node *child;        // the node that moves into the removed spot (can be null)
+		Node *childParent;  // its parent, since we can't ask a null child
+
+		if (node->left == nullptr) {
+			// Zero or one (right) child: the child just takes our place
+			child = node->right;
+			childParent = node->GetParent();
+			Transplant(root, node, node->right);
+		} else if (node->right == nullptr) {
+			// Only a left child
+			child = node->left;
+			childParent = node->GetParent();
+			Transplant(root, node, node->left);
+		} else {
+			// Two children: the successor (leftmost of the right subtree) takes our place
+			Node *successor = leaving;
+			removedColor = successor->GetColor();
+			child = successor->right;
+
+			if (successor->GetParent() == node) {
+				childParent = successor;
+			} else {
+				childParent = successor->GetParent();
+				Transplant(root, successor, successor->right);
+				StoreShared(successor->right, node->right);
+				successor->right->SetParent(successor);
+			}
+			Transplant(root, node, successor);
+			StoreShared(successor->left, node->left);
+			successor->left->SetParent(successor);
+			successor->SetColor(node->GetColor());
+			successor->size = node->size;
+		}
+
+		// Taking out a black node leaves one path short a black, so fix that up
+		if (removedColor == COLOR_BLACK) {
+			RemoveFixUp(root, child, childParent, counters);
+		}
+	}
+
+	// Fixes the tree after a black node was removed
+	// node is the "double black" spot: it carries an extra black that has to be
+	// pushed up the tree or absorbed with a rotation (at most 3 rotations total)
+	template <typename Counters>
+	static void RemoveFixUp(Node *&root, Node *node, Node *parent, Counters counters) {
+		while (node != root && IsBlack(node)) {
+			if (node == parent->left) {
+				Node *sibling = parent->right;
+				if (sibling->GetColor() == COLOR_RED) {
+					// Case 1: sibling is red -> rotate so the sibling is black
+					sibling->SetColor(COLOR_BLACK);
+					parent->SetColor(COLOR_RED);
+					LeftRotate(root, parent, counters);
+					sibling = parent->right;
+				}
+				if (IsBlack(sibling->left) && IsBlack(sibling->right)) {
+					// Case 2: sibling has two black children -> recolor and move up
+					sibling->SetColor(COLOR_RED);
+					node = parent;
+					parent = node->GetParent();
+				} else {
+					if (IsBlack(sibling->right)) {
+						// Case 3: sibling's near child is red -> Right Rotate the sibling
+						sibling->left->SetColor(COLOR_BLACK);
+						sibling->SetColor(COLOR_RED);
+						RightRotate(root, sibling, counters);
+						sibling = parent->right;
+					}
+					// Case 4: sibling's far child is red -> Left Rotate the parent and we're done
+					sibling->SetColor(parent->GetColor());
+					parent->SetColor(COLOR_BLACK);
+					sibling->right->SetColor(COLOR_BLACK);
+					LeftRotate(root, parent, counters);
+					node = root;
+				}
+			} else {
+				// Same as above with left and right swapped
+				Node *sibling = parent->left;
+				if (sibling->GetColor() == COLOR_RED) {
+					// Case 1 mirror
+					sibling->SetColor(COLOR_BLACK);
+					parent->SetColor(COLOR_RED);
+					RightRotate(root, parent, counters);
+					sibling = parent->left;
+				}
+				if (IsBlack(sibling->left) && IsBlack(sibling->right)) {
+					// Case 2 mirror
+					sibling->SetColor(COLOR_RED);
+					node = parent;
+					parent = node->GetParent();
+				} else {
+					if (IsBlack(sibling->left)) {
+						// Case 3 mirror
+						sibling->right->SetColor(COLOR_BLACK);
+						sibling->SetColor(COLOR_RED);
+						LeftRotate(root, sibling, counters);
+						sibling = parent->left;
+					}
+					// Case 4 mirror
+					sibling->SetColor(parent->GetColor());
+					parent->SetColor(COLOR_BLACK);
+					sibling->left->SetColor(COLOR_BLACK);
+					RightRotate(root, parent, counters);
+					node = root;
+				}
+			}
+		}
+		if (node != nullptr) {
+			node->SetColor(COLOR_BLACK);
+		}
+	}
+
+	// Next node in sorted order, or nullptr after the last one
+	static const Node *Successor(const Node *node) {
+		if (node->right != nullptr) {
+			// Leftmost node of the right subtree
+			node = node->right;
+			while (node->left != nullptr) {
+				node = node->left;
+			}
+			return node;
+		}
+		// Otherwise climb until we come up from a left child
+		const Node *parent = node->GetParent();
+		while (parent != nullptr && parent->right == node) {
+			node = parent;
+			parent = node->GetParent();
+		}
+		return parent;
+	}
+
+	// Previous node in sorted order, or nullptr before the first one
+	static const Node *Predecessor(const Node *node) {
+		if (node->left != nullptr) {
+			// Rightmost node of the left subtree
+			node = node->left;
+			while (node->right != nullptr) {
+				node = node->right;
+			}
+			return node;
+		}
+		// Otherwise climb until we come up from a right child
+		const Node *parent = node->GetParent();
+		while (parent != nullptr && parent->left == node) {
+			node = parent;
+			parent = node->GetParent();
+		}
+		return parent;
+	}
+
+	// Makes a deep copy of node and its children with the exact same shape, so
+	// there's no re-inserting or rebalancing. Walks the source with parent
+	// pointers (no recursion) in prefix order. makeCopy(from) returns a new node
+	// holding a copy of from->data and must clean up after itself if it throws;
+	// then every node copied so far is handed to drop and the exception goes on.
+	template <typename MakeCopy, typename Drop>
+	static Node *Clone(const Node *node, MakeCopy makeCopy, Drop drop) {
+		if (node == nullptr) return nullptr; // Nothing to copy
+
+		auto clone = [&](const Node *from, Node *parent) {
+			Node *copy = makeCopy(from);
+			copy->size = from->size;
+			copy->SetColor(from->GetColor());
+			copy->SetParent(parent);
+			return copy;
+		};
+
+		Node *copyRoot = clone(node, nullptr);
+		try {
+			const Node *from = node;
+			Node *to = copyRoot;
+			while (true) {
+				if (from->left != nullptr && to->left == nullptr) {
+					// Left side not copied yet, go down it
+					to->left = clone(from->left, to);
+					from = from->left;
+					to = to->left;
+				} else if (from->right != nullptr && to->right == nullptr) {
+					// Then the right side
+					to->right = clone(from->right, to);
+					from = from->right;
+					to = to->right;
+				} else if (from == node) {
+					break; // Back at the top with both sides done
+				} else {
+					// This subtree is done, go back up in both trees
+					from = from->GetParent();
+					to = to->GetParent();
+				}
+			}
+		} catch (...) {
+			// Everything copied so far is linked under copyRoot
+			Destroy(copyRoot, drop);
+			throw;
+		}
+		return copyRoot;
+	}
+
+	// Hands every node under node to drop without recursion.
+	// Goes down to a leaf, drops it and steps back up, so each node costs O(1).
+	template <typename Drop>
+	static void Destroy(Node *node, Drop drop) {
+		if (node == nullptr) {
+			return;
+		}
+		Node *stop = node->GetParent();
+		while (node != stop) {
+			if (node->left != nullptr) {
+				node = node->left;
+			} else if (node->right != nullptr) {
+				node = node->right;
+			} else {
+				Node *parent = node->GetParent();
+				if (parent != nullptr) {
+					// Unhook the leaf so the parent becomes a leaf once both sides are gone
+					if (parent->left == node) {
+						parent->left = nullptr;
+					} else {
+						parent->right = nullptr;
+					}
+				}
+				drop(node);
+				node = parent;
+			}
+		}
+	}
+};
+
+#endif
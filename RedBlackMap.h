@@ -0,0 +1,263 @@
+#ifndef REDBLACKMAP_H
+#define REDBLACKMAP_H
+
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "NodePool.h"
+#include "RedBlackCore.h"
+
+using namespace std;
+
+// Red black tree that maps keys to values.
+// RedBlackTree is the int set; this is the general version for any key type,
+// ordered by Compare, with the value stored right inside the node. Nodes come
+// from a BasicNodePool using Alloc, and values are built in place by Emplace.
+// The balancing is the same code RedBlackTree runs (RedBlackCore.h); this
+// class only adds the key comparisons and building/destroying entries.
+template <typename Key, typename Value, typename Compare = less<Key>,
+          typename Alloc = allocator<pair<const Key, Value>>>
+class RedBlackMap {
+
+	public:
+		typedef pair<const Key, Value> Entry;
+
+		RedBlackMap() {}
+		explicit RedBlackMap(const Compare &compare) : compare(compare) {}
+		RedBlackMap(const RedBlackMap &other) : compare(other.compare) {
+			root = CopyOf(other.root);
+			numItems = other.numItems;
+		}
+		RedBlackMap(RedBlackMap &&other) noexcept
+			: numItems(other.numItems), root(other.root),
+			  pool(std::move(other.pool)), compare(std::move(other.compare)) {
+			other.root = nullptr;
+			other.numItems = 0;
+		}
+		RedBlackMap &operator=(RedBlackMap other) {
+			swap(numItems, other.numItems);
+			swap(root, other.root);
+			swap(pool, other.pool);
+			swap(compare, other.compare);
+			return *this;
+		}
+		~RedBlackMap() { Clear(); }
+
+		// Builds the value in place from args; returns false (and builds nothing)
+		// if key is already there. An rvalue key is moved into the node.
+		template <typename... Args>
+		bool Emplace(const Key &key, Args &&...args) {
+			return EmplaceKey(key, std::forward<Args>(args)...);
+		}
+		template <typename... Args>
+		bool Emplace(Key &&key, Args &&...args) {
+			return EmplaceKey(std::move(key), std::forward<Args>(args)...);
+		}
+
+		// Throws invalid_argument on a duplicate key, like RedBlackTree::Insert
+		void Insert(const Key &key, Value value) {
+			if (!Emplace(key, std::move(value))) {
+				throw invalid_argument("Duplicate key insertion is not allowed.");
+			}
+		}
+		void Insert(Key &&key, Value value) {
+			if (!Emplace(std::move(key), std::move(value))) {
+				throw invalid_argument("Duplicate key insertion is not allowed.");
+			}
+		}
+
+		// Returns the value stored for key, or nullptr if it isn't there
+		Value *Find(const Key &key) {
+			Node *node = Get(key);
+			return node == nullptr ? nullptr : &node->data.second;
+		}
+		const Value *Find(const Key &key) const {
+			const Node *node = Get(key);
+			return node == nullptr ? nullptr : &node->data.second;
+		}
+
+		bool Contains(const Key &key) const { return Get(key) != nullptr; }
+
+		Value &At(const Key &key) {
+			Value *value = Find(key);
+			if (value == nullptr) {
+				throw out_of_range("Key is not in the map");
+			}
+			return *value;
+		}
+		const Value &At(const Key &key) const {
+			const Value *value = Find(key);
+			if (value == nullptr) {
+				throw out_of_range("Key is not in the map");
+			}
+			return *value;
+		}
+
+		// Adds a default constructed value if key isn't there yet
+		Value &operator[](const Key &key) { return Slot(key); }
+		Value &operator[](Key &&key) { return Slot(std::move(key)); }
+
+		// Returns false if key wasn't in the map
+		bool Remove(const Key &key) {
+			Node *node = Get(key);
+			if (node == nullptr) {
+				return false;
+			}
+			RemoveNode(node);
+			return true;
+		}
+
+		const Key &GetMinKey() const { return Extreme(true)->data.first; }
+		const Key &GetMaxKey() const { return Extreme(false)->data.first; }
+
+		// Calls visit(key, value) on every entry in key order
+		template <typename Visitor>
+		void ForEach(Visitor visit) const {
+			for (const Node *n = First(); n != nullptr; n = Next(n)) {
+				visit(n->data.first, n->data.second);
+			}
+		}
+
+		size_t Size() const { return numItems; }
+
+		void Clear() {
+			if (!is_trivially_destructible<Entry>::value) {
+				for (Node *n = First(); n != nullptr; n = Next(n)) {
+					n->data.~Entry(); // links are still fine to follow afterwards
+				}
+			}
+			pool.Release();
+			root = nullptr;
+			numItems = 0;
+		}
+
+	private:
+		typedef BasicRBTNode<Entry> Node;
+		typedef RedBlackCore<Node> Core;
+		typedef BasicNodePool<Node, Alloc> Pool;
+
+		unsigned long long int numItems = 0;
+		Node *root = nullptr;
+		Pool pool;
+		Compare compare;
+
+		// Finds key, or leaves parent at the node a new key would hang from
+		Node *FindSlot(const Key &key, Node *&parent) const {
+			Node *current = root;
+			while (current != nullptr) {
+				parent = current;
+				if (compare(key, current->data.first)) {
+					current = current->left;
+				} else if (compare(current->data.first, key)) {
+					current = current->right;
+				} else {
+					return current;
+				}
+			}
+			return nullptr;
+		}
+
+		Node *Get(const Key &key) const {
+			Node *parent = nullptr;
+			return FindSlot(key, parent);
+		}
+
+		template <typename K, typename... Args>
+		bool EmplaceKey(K &&key, Args &&...args) {
+			Node *parent = nullptr;
+			if (FindSlot(key, parent) != nullptr) {
+				return false;
+			}
+			Node *node = NewNode(piecewise_construct, forward_as_tuple(std::forward<K>(key)),
+			                     forward_as_tuple(std::forward<Args>(args)...));
+			Attach(node, parent);
+			return true;
+		}
+
+		template <typename K>
+		Value &Slot(K &&key) {
+			Node *parent = nullptr;
+			Node *existing = FindSlot(key, parent);
+			if (existing != nullptr) {
+				return existing->data.second;
+			}
+			Node *node = NewNode(piecewise_construct, forward_as_tuple(std::forward<K>(key)), forward_as_tuple());
+			Attach(node, parent);
+			return node->data.second;
+		}
+
+		// Builds an entry in a node from the pool. If the entry's constructor
+		// throws, the node goes straight back on the free list.
+		template <typename... Args>
+		Node *NewNode(Args &&...args) {
+			Node *node = pool.Allocate();
+			try {
+				return new (node) Node(in_place, std::forward<Args>(args)...);
+			} catch (...) {
+				pool.Free(node);
+				throw;
+			}
+		}
+
+		void Attach(Node *node, Node *parent) {
+			node->SetParent(parent);
+			node->SetColor(COLOR_RED);
+			if (parent == nullptr) {
+				root = node;
+			} else if (compare(node->data.first, parent->data.first)) {
+				parent->left = node;
+			} else {
+				parent->right = node;
+			}
+			for (Node *p = parent; p != nullptr; p = p->GetParent()) {
+				p->size++; // Everything above the new node grew by one
+			}
+			Core::InsertFixUp(root, node, NoTreeCounters());
+			numItems++;
+		}
+
+		// Copies the tree without recursion. If copying an entry throws, the
+		// entries copied so far are destroyed and their nodes freed.
+		Node *CopyOf(const Node *node) {
+			return Core::Clone(node,
+				[&](const Node *from) { return NewNode(from->data); },
+				[&](Node *copy) {
+					copy->~Node();
+					pool.Free(copy);
+				});
+		}
+
+		const Node *Extreme(bool leftmost) const {
+			if (root == nullptr) {
+				throw runtime_error("Red Black Map is empty");
+			}
+			const Node *n = root;
+			while ((leftmost ? n->left : n->right) != nullptr) {
+				n = leftmost ? n->left : n->right;
+			}
+			return n;
+		}
+
+		Node *First() const {
+			Node *n = root;
+			while (n != nullptr && n->left != nullptr) n = n->left;
+			return n;
+		}
+
+		static Node *Next(const Node *n) {
+			return const_cast<Node *>(Core::Successor(n));
+		}
+
+		void RemoveNode(Node *node) {
+			Core::Unlink(root, node, NoTreeCounters());
+			node->~Node();
+			pool.Free(node);
+			numItems--;
+		}
+};
+
+#endif
@@ -2,7 +2,33 @@
 //Date: 27/04/2025
 
 #include "RedBlackTree.h"
+#include "FrozenRedBlackTree.h"
 #include <stdexcept> // for exceptions
+#include <new> // for placement new
+#include <charconv> // for to_chars
+#include <algorithm> // for min
+#include <climits> // for LLONG_MAX
+#include <future> // for async
+#include <thread> // for hardware_concurrency
+#include <cstring> // for memcmp
+#include <fstream> // for Save
+#include <fcntl.h> // for open
+#include <sys/mman.h> // for mmap
+#include <sys/stat.h> // for fstat
+#include <unistd.h> // for close
+
+// Hot path counters, see BasicTreeStats. Without RBT_STATS they compile away.
+#ifdef RBT_STATS
+#define RBT_COUNT_N(counter, n) (stats.counter.fetch_add((n), memory_order_relaxed))
+#define RBT_COUNT_DEPTH(depth) \
+    RBT_COUNT_N(depthHistogram[std::min<size_t>((depth), RedBlackTreeStats::DEPTH_BUCKETS - 1)], 1)
+const bool RedBlackTree::STATS_ENABLED = true;
+#else
+#define RBT_COUNT_N(counter, n) ((void)(n))
+#define RBT_COUNT_DEPTH(depth) ((void)(depth))
+const bool RedBlackTree::STATS_ENABLED = false;
+#endif
+#define RBT_COUNT(counter) RBT_COUNT_N(counter, 1)
 
 // Creates an empty tree as default
 RedBlackTree::RedBlackTree() {
@@ -12,157 +38,419 @@ RedBlackTree::RedBlackTree() {
 
 // Creates a tree with a single node (the root)
 RedBlackTree::RedBlackTree(int newData) {
-    root = new RBTNode();
-    root->data = newData;
-    root->color = COLOR_BLACK;  // Root should always be black
-    root->left = nullptr;
-    root->right = nullptr;
-    root->parent = nullptr;
-    root->IsNullNode = false;   // It's a real node
+    root = NewNode(newData, COLOR_BLACK);  // Root should always be black
+    leftmost = rightmost = root;
     numItems = 1;               // Tree has only one item
 }
 
 // Creates a copy constructor that creates a new red-black tree
 RedBlackTree::RedBlackTree(const RedBlackTree &rbt) {
     root = CopyOf(rbt.root);  
-}
-
-// Makes a deep copy of a node and its children
-RBTNode* RedBlackTree::CopyOf(const RBTNode *node) {
-    if (node == nullptr) return nullptr; // Base case: if node is null, return null
+    numItems = rbt.numItems;
 
-    RBTNode* copy = new RBTNode();
-    copy->data = node->data;
-    copy->color = node->color;
-    copy->IsNullNode = node->IsNullNode;
-    copy->left = CopyOf(node->left); // Recursively copy left subtree
-    copy->right = CopyOf(node->right); // Recursively copy right subtree
+    // Find the ends of the copy once instead of on every GetMin/GetMax
+    leftmost = rightmost = root;
+    while (leftmost != nullptr && leftmost->left != nullptr) leftmost = leftmost->left;
+    while (rightmost != nullptr && rightmost->right != nullptr) rightmost = rightmost->right;
+}
 
-    // Parent needs to be set later in the tree structure
-    if (copy->left != nullptr) copy->left->parent = copy;
-    if (copy->right != nullptr) copy->right->parent = copy;
+// Moving a tree just hands over the root and the pool, no nodes are touched
+RedBlackTree::RedBlackTree(RedBlackTree &&rbt) noexcept {
+    Steal(rbt);
+}
 
-    return copy;
+RedBlackTree& RedBlackTree::operator=(const RedBlackTree &rbt) {
+    if (this != &rbt) {
+        RedBlackTree copy(rbt);
+        *this = std::move(copy);
+    }
+    return *this;
 }
 
-// Helper function to print Prefix traveral order
-// Prefix = current node -> left subtree -> right subtree
-string RedBlackTree::ToPrefixString(const RBTNode *n) {
-    if (n == nullptr || n->IsNullNode) {
-        return ""; // Null or empty node, return empty string
+RedBlackTree& RedBlackTree::operator=(RedBlackTree &&rbt) noexcept {
+    if (this != &rbt) {
+        Steal(rbt); // Our old nodes go with the old pool
     }
+    return *this;
+}
 
-    string result = "";
+// Takes everything from rbt and leaves it an empty tree
+void RedBlackTree::Steal(RedBlackTree &rbt) {
+    root = rbt.root;
+    leftmost = rbt.leftmost;
+    rightmost = rbt.rightmost;
+    numItems = rbt.numItems;
+    pool = std::move(rbt.pool); // rbt makes a new pool if it's used again
+    rbt.root = rbt.leftmost = rbt.rightmost = nullptr;
+    rbt.numItems = 0;
+}
 
-    result += GetNodeString(n);
+void RedBlackTree::Clear() {
+    DeleteTree(root);
+    root = leftmost = rightmost = nullptr;
+    numItems = 0;
+}
 
-    if (n->left != nullptr) {
-        result += ToPrefixString(n->left);
+// The pool, made the first time it's needed (a moved-from tree has none)
+NodePool& RedBlackTree::Pool() {
+    if (pool == nullptr) {
+        pool = make_shared<NodePool>();
     }
+    return *pool;
+}
 
-    if (n->right != nullptr) {
-        result += ToPrefixString(n->right);
+// Makes sure our pool keeps rbt's nodes alive before they get linked into this tree
+void RedBlackTree::AdoptPool(RedBlackTree &rbt) {
+    if (rbt.pool == nullptr || (pool != nullptr && pool->Holds(*rbt.pool))) {
+        return;
+    }
+    if (pool == nullptr) {
+        pool = rbt.pool; // Nothing of our own yet, just use theirs
+    } else {
+        pool->Adopt(*rbt.pool);
     }
+}
 
-    return result;
+// Makes a node out of the pool instead of calling new
+RBTNode* RedBlackTree::NewNode(int data, unsigned short int color) {
+    // The slot may be a freed node a ConcurrentRedBlackTree reader still has
+    RBTNode* node = new (Pool().Allocate()) RBTNode(shared_init, data);
+    RBT_COUNT(nodeAllocations);
+    node->SetColor(color);
+    return node;
 }
 
-// Helper function to print Postfix traveral order
-// Postfix = left subtree -> right subtree -> current node
-string RedBlackTree::ToPostfixString(const RBTNode *n) {
-    if (n == nullptr || n->IsNullNode) {
-        return ""; // Null or empty node, return empty string
+// Turns count sorted nodes into a balanced tree by always picking the middle
+// as the subtree root. Every null link ends up at the same depth give or take
+// one, so painting the deepest level red makes every path equally black.
+void RedBlackTree::LinkSorted(RBTNode *nodes, size_t count) {
+    RBT_COUNT_N(nodeAllocations, count);
+    numItems = count;
+    if (count == 0) {
+        return;
     }
-
-    string result = "";
-
-    if (n->left != nullptr) {
-        result += ToPostfixString(n->left);
+    unsigned int deepest = 0;
+    while ((size_t(2) << deepest) <= count) {
+        deepest++; // floor(log2(count)) is the depth of the bottom level
     }
+    root = LinkRange(nodes, 0, count, 0, deepest);
+    root->SetParent(nullptr);
+    leftmost = &nodes[0];
+    rightmost = &nodes[count - 1];
+}
 
-    if (n->right != nullptr) {
-        result += ToPostfixString(n->right);
+// Links nodes[low, high) into a subtree and returns its root
+RBTNode* RedBlackTree::LinkRange(RBTNode *nodes, size_t low, size_t high, unsigned int depth, unsigned int redDepth) {
+    if (low == high) {
+        return nullptr;
     }
+    size_t middle = low + (high - low) / 2;
+    RBTNode *node = &nodes[middle];
+    node->SetColor(depth == redDepth && depth > 0 ? COLOR_RED : COLOR_BLACK);
+    node->size = (unsigned int)(high - low);
+    node->left = LinkRange(nodes, low, middle, depth + 1, redDepth);
+    node->right = LinkRange(nodes, middle + 1, high, depth + 1, redDepth);
+    if (node->left != nullptr) node->left->SetParent(node);
+    if (node->right != nullptr) node->right->SetParent(node);
+    return node;
+}
 
-    result += GetNodeString(n);
+// Makes a deep copy of a node and its children
+// The copy has the exact same shape, so there's no re-inserting or rebalancing.
+// It walks the source with parent pointers (no recursion) and puts the copied
+// nodes in one block in prefix order.
+RBTNode* RedBlackTree::CopyOf(const RBTNode *node) {
+    if (node == nullptr) return nullptr; // Nothing to copy
 
-    return result;
+    RBTNode *block = Pool().AllocateBlock(node->size);
+    RBT_COUNT_N(nodeAllocations, node->size);
+    size_t used = 0;
+    return Core::Clone(node,
+        [&](const RBTNode *from) {
+            RBTNode *copy = new (&block[used++]) RBTNode();
+            copy->data = from->data;
+            return copy;
+        },
+        [](RBTNode *) {}); // Copying ints can't throw, so nothing is ever dropped
 }
 
-// Helper function to print Infix traveral order
-// Infix = left subtree -> current node -> right subtree
-string RedBlackTree::ToInfixString(const RBTNode *n) {
-    if (n == nullptr || n->IsNullNode) {
-        return ""; // Null or empty node, return empty string
+// Gives every node under node back to the pool without recursion.
+// Goes down to a leaf, frees it and steps back up, so each node costs O(1).
+void RedBlackTree::DeleteTree(RBTNode *node) {
+    if (node == nullptr) {
+        return;
     }
+    Core::Destroy(node, [&](RBTNode *n) {
+        n->~RBTNode();
+        pool->Free(n);
+    });
+}
+
+// The traversals below walk the tree with the parent pointers, so there's no
+// recursion and no string per subtree. Each node is formatted into a small
+// buffer with to_chars and handed to a sink in big chunks.
+
+static const size_t TRAVERSE_BUFFER_SIZE = 4096;
+
+// Sink that appends to a string
+struct StringSink {
+    string &out;
+    void Write(const char *chars, size_t count) { out.append(chars, count); }
+};
+
+// Sink that writes to an ostream
+struct StreamSink {
+    ostream &out;
+    void Write(const char *chars, size_t count) { out.write(chars, count); }
+};
+
+// Collects node strings and flushes them to the sink when the buffer fills up
+template <typename Sink>
+class NodeWriter {
+    public:
+        NodeWriter(Sink &sink) : sink(sink) {}
+        ~NodeWriter() { Flush(); }
+
+        void Visit(const RBTNode *n, char *(*write)(char *, const RBTNode *)) {
+            if (TRAVERSE_BUFFER_SIZE - used < RedBlackTree::MAX_NODE_CHARS) Flush();
+            used = write(buffer + used, n) - buffer;
+        }
+
+        void Flush() {
+            if (used > 0) sink.Write(buffer, used);
+            used = 0;
+        }
 
-    string result = "";
+    private:
+        Sink &sink;
+        char buffer[TRAVERSE_BUFFER_SIZE];
+        size_t used = 0;
+};
 
-    if (n->left != nullptr) {
-        result += ToInfixString(n->left);
+// Prefix = current node -> left subtree -> right subtree
+template <typename Visitor>
+static void PrefixWalk(const RBTNode *n, Visitor visit) {
+    while (n != nullptr) {
+        visit(n);
+        if (n->left != nullptr) {
+            n = n->left;
+        } else if (n->right != nullptr) {
+            n = n->right;
+        } else {
+            // Climb until we come up from a left child that has a right sibling
+            const RBTNode *parent = n->GetParent();
+            while (parent != nullptr && (parent->right == n || parent->right == nullptr)) {
+                n = parent;
+                parent = n->GetParent();
+            }
+            n = parent == nullptr ? nullptr : parent->right;
+        }
     }
+}
+
+// Postfix = left subtree -> right subtree -> current node
+template <typename Visitor>
+static void PostfixWalk(const RBTNode *n, Visitor visit) {
+    // Goes down to the first node postfix visits under n
+    auto firstLeaf = [](const RBTNode *n) {
+        while (n->left != nullptr || n->right != nullptr) {
+            n = n->left != nullptr ? n->left : n->right;
+        }
+        return n;
+    };
 
-    result += GetNodeString(n);
+    if (n == nullptr) return;
+    n = firstLeaf(n);
+    while (n != nullptr) {
+        visit(n);
+        const RBTNode *parent = n->GetParent();
+        if (parent != nullptr && parent->left == n && parent->right != nullptr) {
+            n = firstLeaf(parent->right); // Left side is done, now the right side
+        } else {
+            n = parent; // Both sides done, the parent is next
+        }
+    }
+}
 
-    if (n->right != nullptr) {
-        result += ToInfixString(n->right);
+// Infix = left subtree -> current node -> right subtree
+template <typename Visitor>
+static void InfixWalk(const RBTNode *n, Visitor visit, const RBTNode *(*successor)(const RBTNode *)) {
+    if (n == nullptr) return;
+    while (n->left != nullptr) {
+        n = n->left;
+    }
+    for (; n != nullptr; n = successor(n)) {
+        visit(n);
     }
+}
 
+string RedBlackTree::ToPrefixString() const {
+    string result;
+    result.reserve(numItems * STRING_CHARS_PER_NODE);
+    StringSink sink{result};
+    NodeWriter<StringSink> writer(sink);
+    PrefixWalk(root, [&](const RBTNode *n) { writer.Visit(n, WriteNode); });
+    writer.Flush();
     return result;
 }
 
-// Convert node's data and color into string
-string RedBlackTree::GetNodeString(const RBTNode *n) {
-    // If the node is empty, return an empty space
-    if (n == nullptr || n->IsNullNode) {
-        return "";
-    }
+string RedBlackTree::ToPostfixString() const {
+    string result;
+    result.reserve(numItems * STRING_CHARS_PER_NODE);
+    StringSink sink{result};
+    NodeWriter<StringSink> writer(sink);
+    PostfixWalk(root, [&](const RBTNode *n) { writer.Visit(n, WriteNode); });
+    writer.Flush();
+    return result;
+}
 
-    // Format: [color][value] i.e. B5, R7
-    string result = " " + GetColorString(n) + to_string(n->data) + " ";
-    // cout << result << endl;
+string RedBlackTree::ToInfixString() const {
+    string result;
+    result.reserve(numItems * STRING_CHARS_PER_NODE);
+    StringSink sink{result};
+    NodeWriter<StringSink> writer(sink);
+    InfixWalk(root, [&](const RBTNode *n) { writer.Visit(n, WriteNode); }, Successor);
+    writer.Flush();
     return result;
 }
 
-// Get color for a node
-string RedBlackTree::GetColorString(const RBTNode *n) {
-    if (n == nullptr) {
-        return "";
-    }
+void RedBlackTree::WritePrefix(ostream &out) const {
+    StreamSink sink{out};
+    NodeWriter<StreamSink> writer(sink);
+    PrefixWalk(root, [&](const RBTNode *n) { writer.Visit(n, WriteNode); });
+}
+
+void RedBlackTree::WritePostfix(ostream &out) const {
+    StreamSink sink{out};
+    NodeWriter<StreamSink> writer(sink);
+    PostfixWalk(root, [&](const RBTNode *n) { writer.Visit(n, WriteNode); });
+}
 
-    switch (n->color) {
+void RedBlackTree::WriteInfix(ostream &out) const {
+    StreamSink sink{out};
+    NodeWriter<StreamSink> writer(sink);
+    InfixWalk(root, [&](const RBTNode *n) { writer.Visit(n, WriteNode); }, Successor);
+}
+
+// Writes a node in the " B30 " format into out and returns the end of it
+char* RedBlackTree::WriteNode(char *out, const RBTNode *n) {
+    return FormatNode(out, n->GetColor(), n->data);
+}
+
+char* RedBlackTree::FormatNode(char *out, unsigned short int color, int data) {
+    *out++ = ' ';
+    switch (color) {
         case COLOR_RED:
-            return "R";
+            *out++ = 'R';
+            break;
         case COLOR_BLACK:
-            return "B";
+            *out++ = 'B';
+            break;
         case COLOR_DOUBLE_BLACK:
-            return "DB"; // Will be used for delete operations later
+            *out++ = 'D';
+            *out++ = 'B';
+            break;
         default:
-            return "?"; // Unknown color
+            *out++ = '?';
     }
+    out = to_chars(out, out + 11, data).ptr; // 11 chars fits any int
+    *out++ = ' ';
+    return out;
 }
 
 void RedBlackTree::Insert(int newData) {
-    // First, check if the value already exists
-    if (Contains(newData)) {
+    if (!TryInsert(newData)) {
+        throw std::invalid_argument("Duplicate value insertion is not allowed.");
+    }
+}
+
+bool RedBlackTree::TryInsert(int newData) {
+    bool inserted = false;
+    InsertFrom(EndFor(newData), newData, inserted);
+    return inserted;
+}
+
+RedBlackTree::Iterator RedBlackTree::Insert(Iterator hint, int newData) {
+    // end() as a hint means "goes at the back", same as in the STL
+    RBTNode *finger = const_cast<RBTNode *>(hint.node != nullptr ? hint.node : rightmost);
+    bool inserted = false;
+    RBTNode *node = InsertFrom(StartFor(finger, newData), newData, inserted);
+    if (!inserted) {
         throw std::invalid_argument("Duplicate value insertion is not allowed.");
     }
+    return Iterator(node, this);
+}
 
-    // Create a new node using the struct 
-    RBTNode* newNode = new RBTNode();
-    newNode->data = newData;
-    newNode->color = COLOR_RED;  // new nodes are red by default in Red Black Trees
+// Append fast path: a key past either end goes right under the cached end
+// node, so there's no search from the root (the subtree sizes above it still
+// get bumped on the way up)
+RBTNode* RedBlackTree::EndFor(int newData) const {
+    if (rightmost != nullptr && newData > rightmost->data) {
+        return rightmost;
+    }
+    if (leftmost != nullptr && newData < leftmost->data) {
+        return leftmost;
+    }
+    return root;
+}
 
-    // Insert it into the tree
-    BasicInsert(newNode);
+// Inserts newData searching down from start (which must be a node whose
+// subtree newData belongs in) and fixes the colors. Returns the node holding
+// newData, which is the old one if it was a duplicate.
+RBTNode* RedBlackTree::InsertFrom(RBTNode *start, int newData, bool &inserted) {
+    // Find the spot and check for a duplicate in the same walk down the tree
+    RBTNode* newNode = BasicInsert(newData, inserted, start);
+    if (!inserted) {
+        return newNode; // The value is already in the tree
+    }
 
     // Follow the binary serach tree to add the node as the leaf node
-    if(newNode->parent != nullptr && newNode->parent->color == COLOR_RED) {
+    if(newNode->GetParent() != nullptr && newNode->GetParent()->GetColor() == COLOR_RED) {
         InsertFixUp(newNode);
     }
 
     // Update the number of items
     numItems++;
+    return newNode;
+}
+
+// Where a search that has a finger starts: a key past either end goes
+// straight under that end whatever the finger, anything else climbs from it
+RBTNode* RedBlackTree::StartFor(RBTNode *finger, int newData) const {
+    RBTNode *start = EndFor(newData);
+    return start != root ? start : ClimbFrom(finger, newData);
+}
+
+// Where to start searching for newData when the last key went to finger: the
+// lowest node above finger whose subtree newData belongs in. Going up, a step
+// from a right child doesn't change the subtree's upper bound, so only a step
+// from a left child onto something bigger than newData ends the climb. Going
+// down is the mirror image. Keys close to the finger only climb a little;
+// far ones give up after a few steps and start from the root instead, so a
+// sparse batch doesn't pay for a climb to the top and a search back down.
+static const int MAX_CLIMB = 8;
+
+RBTNode* RedBlackTree::ClimbFrom(RBTNode *finger, int newData) const {
+    if (finger == nullptr) {
+        return root;
+    }
+    if (newData == finger->data) {
+        return finger; // Duplicate, the search stops right there
+    }
+    bool up = newData > finger->data;
+    RBTNode *node = finger;
+    int steps = 0;
+    for (RBTNode *parent = node->GetParent(); parent != nullptr; node = parent, parent = node->GetParent()) {
+        if (++steps > MAX_CLIMB) {
+            return root;
+        }
+        bool bounded = up ? parent->left == node && newData < parent->data
+                          : parent->right == node && newData > parent->data;
+        if (bounded) {
+            break;
+        }
+    }
+    return node;
 }
 
 bool RedBlackTree::Contains(int data) const {
@@ -174,196 +462,841 @@ int RedBlackTree::GetMin() const {
     if (root == nullptr) {
         throw std::runtime_error("Red Black Tree is empty");
     }
-    
-    RBTNode *current = root;
-    while (current->left != nullptr) {
-        current = current->left;  // Move to the leftmost node
-    }
-    return current->data;  // The leftmost node contains the minimum value
+    return MinNode()->data;  // The leftmost node contains the minimum value
 }
 
 int RedBlackTree::GetMax() const {
     if (root == nullptr) {
         throw std::runtime_error("Red Black Tree is empty");
     }
-    
-    RBTNode *current = root;
-    while (current->right != nullptr) {
-        current = current->right;  // Move to the rightmost node
+    return MaxNode()->data;  // The rightmost node contains the maximum value
+}
+
+int RedBlackTree::PopMin() {
+    if (root == nullptr) {
+        throw std::runtime_error("Red Black Tree is empty");
     }
-    return current->data;  // The rightmost node contains the maximum value
+    int data = leftmost->data;
+    RemoveNode(leftmost);
+    return data;
 }
 
-// BasicInsert just inserts like a regular BST
-void RedBlackTree::BasicInsert(RBTNode *node) {
+int RedBlackTree::PopMax() {
     if (root == nullptr) {
-        root = node; // Assigning the node as the root of one doesn't exist
-        node->color = COLOR_BLACK; // Root must always be black
-        return;
+        throw std::runtime_error("Red Black Tree is empty");
     }
+    int data = rightmost->data;
+    RemoveNode(rightmost);
+    return data;
+}
 
-    RBTNode *current = root;
+int RedBlackTree::Select(size_t k) const {
+    if (k >= SizeOf(root)) {
+        throw std::out_of_range("Select index is past the end of the tree");
+    }
+    const RBTNode *current = root;
+    while (true) {
+        size_t leftSize = SizeOf(current->left);
+        if (k < leftSize) {
+            current = current->left;  // It's in the left subtree
+        } else if (k == leftSize) {
+            return current->data;     // Exactly leftSize keys are smaller
+        } else {
+            k -= leftSize + 1;        // Skip the left subtree and this node
+            current = current->right;
+        }
+    }
+}
+
+size_t RedBlackTree::Rank(int data) const {
+    size_t smaller = 0;
+    const RBTNode *current = root;
+    while (current != nullptr) {
+        if (data <= current->data) {
+            current = current->left;
+        } else {
+            // This node and its whole left subtree are smaller
+            smaller += SizeOf(current->left) + 1;
+            current = current->right;
+        }
+    }
+    return smaller;
+}
+
+size_t RedBlackTree::CountInRange(int low, int high) const {
+    if (high <= low) {
+        return 0;
+    }
+    return Rank(high) - Rank(low);
+}
+
+RedBlackTree::Iterator RedBlackTree::begin() const {
+    return Iterator(MinNode(), this);
+}
+
+RedBlackTree::Iterator RedBlackTree::lower_bound(int data) const {
+    const RBTNode *current = root;
+    const RBTNode *best = nullptr; // smallest node >= data seen so far
+    while (current != nullptr) {
+        if (current->data >= data) {
+            best = current;
+            current = current->left;
+        } else {
+            current = current->right;
+        }
+    }
+    return Iterator(best, this);
+}
+
+RedBlackTree::Iterator RedBlackTree::upper_bound(int data) const {
+    const RBTNode *current = root;
+    const RBTNode *best = nullptr; // smallest node > data seen so far
+    while (current != nullptr) {
+        if (current->data > data) {
+            best = current;
+            current = current->left;
+        } else {
+            current = current->right;
+        }
+    }
+    return Iterator(best, this);
+}
+
+pair<RedBlackTree::Iterator, RedBlackTree::Iterator> RedBlackTree::equal_range(int data) const {
+    Iterator first = lower_bound(data);
+    Iterator last = first;
+    if (last != end() && *last == data) {
+        ++last;
+    }
+    return make_pair(first, last);
+}
+
+RedBlackTreeStats RedBlackTree::Stats() const {
+    RedBlackTreeStats snapshot;
+#ifdef RBT_STATS
+    snapshot.leftRotations = stats.leftRotations.load(memory_order_relaxed);
+    snapshot.rightRotations = stats.rightRotations.load(memory_order_relaxed);
+    snapshot.fixupIterations = stats.fixupIterations.load(memory_order_relaxed);
+    snapshot.fixupRecolors = stats.fixupRecolors.load(memory_order_relaxed);
+    snapshot.fixupRotations = stats.fixupRotations.load(memory_order_relaxed);
+    snapshot.searches = stats.searches.load(memory_order_relaxed);
+    for (int i = 0; i < RedBlackTreeStats::DEPTH_BUCKETS; i++) {
+        snapshot.depthHistogram[i] = stats.depthHistogram[i].load(memory_order_relaxed);
+    }
+    snapshot.nodeAllocations = stats.nodeAllocations.load(memory_order_relaxed);
+#endif
+    return snapshot;
+}
+
+// Counts what a set operation's scratch tree did as our own work
+void RedBlackTree::AddStats(const RedBlackTree &scratch) {
+#ifdef RBT_STATS
+    auto add = [](atomic<unsigned long long> &to, const atomic<unsigned long long> &from) {
+        to.fetch_add(from.load(memory_order_relaxed), memory_order_relaxed);
+    };
+    add(stats.leftRotations, scratch.stats.leftRotations);
+    add(stats.rightRotations, scratch.stats.rightRotations);
+    add(stats.fixupIterations, scratch.stats.fixupIterations);
+    add(stats.fixupRecolors, scratch.stats.fixupRecolors);
+    add(stats.fixupRotations, scratch.stats.fixupRotations);
+    add(stats.searches, scratch.stats.searches);
+    for (int i = 0; i < RedBlackTreeStats::DEPTH_BUCKETS; i++) {
+        add(stats.depthHistogram[i], scratch.stats.depthHistogram[i]);
+    }
+    add(stats.nodeAllocations, scratch.stats.nodeAllocations);
+#else
+    (void)scratch;
+#endif
+}
+
+RedBlackTreeReport RedBlackTree::Validate() const {
+    RedBlackTreeReport report;
+    auto fail = [&](const string &error) {
+        report.valid = false;
+        report.error = error;
+        return report;
+    };
+    // Only built when something is wrong, so a valid tree makes no strings
+    auto where = [](const RBTNode *n) { return "node " + to_string(n->data); };
+
+    if (root == nullptr) {
+        if (numItems != 0) return fail("empty tree has numItems " + to_string(numItems));
+        if (leftmost != nullptr || rightmost != nullptr) return fail("empty tree has cached ends");
+        return report;
+    }
+    if (root->GetParent() != nullptr) return fail("root has a parent");
+    if (root->GetColor() != COLOR_BLACK) return fail("root is not black");
+
+    // Depth first with our own stack; each entry carries the open interval
+    // its key has to be in and the black nodes above it
+    struct Pending {
+        const RBTNode *node;
+        long long low;
+        long long high;
+        size_t depth;
+        size_t blacksAbove;
+    };
+    vector<Pending> stack;
+    stack.push_back({root, LLONG_MIN, LLONG_MAX, 0, 0});
+    size_t count = 0;
+    size_t depthTotal = 0;
+    bool sawLeaf = false;
+    const RBTNode *smallest = root;
+    const RBTNode *largest = root;
+
+    while (!stack.empty()) {
+        Pending p = stack.back();
+        stack.pop_back();
+        const RBTNode *n = p.node;
+
+        count++;
+        depthTotal += p.depth;
+        report.height = max(report.height, p.depth + 1);
+        if (n->data <= p.low || n->data >= p.high) return fail(where(n) + " is out of order");
+        if (n->GetColor() != COLOR_RED && n->GetColor() != COLOR_BLACK) return fail(where(n) + " is neither red nor black");
+        if (n->size != 1 + SizeOf(n->left) + SizeOf(n->right)) return fail(where(n) + " has the wrong subtree size");
+        if (n->data < smallest->data) smallest = n;
+        if (n->data > largest->data) largest = n;
+
+        bool red = n->GetColor() == COLOR_RED;
+        size_t blacks = p.blacksAbove + (red ? 0 : 1);
+        const RBTNode *children[2] = {n->left, n->right};
+        for (const RBTNode *child : children) {
+            if (child == nullptr) {
+                // A null link: every one of them has to see the same number of blacks
+                if (!sawLeaf) {
+                    report.blackHeight = blacks;
+                    sawLeaf = true;
+                } else if (blacks != report.blackHeight) {
+                    return fail(where(n) + " has a path with a different black height");
+                }
+                continue;
+            }
+            if (child->GetParent() != n) return fail("child of " + where(n) + " doesn't point back to it");
+            if (red && child->GetColor() == COLOR_RED) return fail("red " + where(n) + " has a red child");
+            bool left = child == n->left;
+            stack.push_back({child, left ? p.low : n->data, left ? n->data : p.high, p.depth + 1, blacks});
+        }
+    }
+
+    if (count != numItems) return fail("numItems is " + to_string(numItems) + " but the tree has " + to_string(count));
+    if (leftmost != smallest || rightmost != largest) return fail("cached min/max node is stale");
+    report.averageDepth = double(depthTotal) / count;
+    return report;
+}
+
+FrozenRedBlackTree RedBlackTree::Freeze() const {
+    return FrozenRedBlackTree(begin(), end());
+}
+
+// Snapshot file layout. Keys are written as raw ints in the machine's byte
+// order, so a snapshot is meant to be loaded on the same kind of machine.
+static const char SNAPSHOT_MAGIC[8] = {'R', 'B', 'T', 'S', 'N', 'A', 'P', '1'};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint64_t count;
+    uint64_t checksum; // FNV-1a over the key bytes
+};
+
+static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+static uint64_t Checksum(uint64_t hash, const int *keys, size_t count) {
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(keys);
+    for (size_t i = 0; i < count * sizeof(int); i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+void RedBlackTree::Save(const string &path) const {
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Can't open " + path + " for writing");
+    }
+
+    // Keys go out in chunks; the header is written again at the end once
+    // the checksum is known
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.count = numItems;
+    header.checksum = FNV_OFFSET;
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    int chunk[TRAVERSE_BUFFER_SIZE];
+    size_t used = 0;
+    auto flush = [&]() {
+        header.checksum = Checksum(header.checksum, chunk, used);
+        out.write(reinterpret_cast<const char *>(chunk), used * sizeof(int));
+        used = 0;
+    };
+    for (int key : *this) {
+        chunk[used++] = key;
+        if (used == TRAVERSE_BUFFER_SIZE) flush();
+    }
+    flush();
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    if (!out.flush()) {
+        throw std::runtime_error("Failed writing " + path);
+    }
+}
+
+// Owns a read-only mapping of a whole file and unmaps it when done
+class MappedFile {
+    public:
+        explicit MappedFile(const string &path) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error("Can't open " + path);
+            }
+            struct stat info;
+            if (fstat(fd, &info) == 0) {
+                size = info.st_size;
+                if (size > 0) {
+                    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    data = mapped == MAP_FAILED ? nullptr : static_cast<const char *>(mapped);
+                }
+            }
+            close(fd); // The mapping stays valid without the descriptor
+            if (data == nullptr) {
+                throw std::runtime_error("Can't map " + path);
+            }
+            madvise(const_cast<char *>(data), size, MADV_SEQUENTIAL);
+        }
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        ~MappedFile() { munmap(const_cast<char *>(data), size); }
+
+        const char *data = nullptr;
+        size_t size = 0;
+};
+
+RedBlackTree RedBlackTree::Load(const string &path) {
+    MappedFile file(path);
+    SnapshotHeader header;
+    if (file.size < sizeof(header)) {
+        throw std::runtime_error(path + " is too short to be a snapshot");
+    }
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(path + " is not a tree snapshot");
+    }
+    if (header.count != (file.size - sizeof(header)) / sizeof(int) ||
+        (file.size - sizeof(header)) % sizeof(int) != 0) {
+        throw std::runtime_error(path + " has the wrong size for its key count");
+    }
+
+    // The header is 24 bytes, so the keys right after it are int aligned
+    const int *keys = reinterpret_cast<const int *>(file.data + sizeof(header));
+    if (Checksum(FNV_OFFSET, keys, header.count) != header.checksum) {
+        throw std::runtime_error(path + " failed its checksum");
+    }
+    try {
+        return BuildFromSorted(keys, keys + header.count);
+    } catch (const std::invalid_argument &) {
+        throw std::runtime_error(path + " has keys out of order");
+    }
+}
+
+// BasicInsert just inserts like a regular BST
+// It walks down once, returning the existing node if the value is already there.
+// The walk starts at start (the root if it's null).
+RBTNode* RedBlackTree::BasicInsert(int newData, bool &inserted, RBTNode *start) {
+    RBTNode *current = start != nullptr ? start : root;
+    RBTNode *above = current != nullptr ? current->GetParent() : nullptr; // first node we don't walk through
     RBTNode *parent = nullptr;
+    size_t depth = 0;
+    RBT_COUNT(searches);
+
+    // Takes back the size bumps made on the way down to below
+    auto takeBack = [above](RBTNode *below) {
+        for (RBTNode *p = below; p != above; p = p->GetParent()) {
+            p->size--;
+        }
+    };
 
     // Travel the tree to find the correct position to insert the new node
     while (current != nullptr) {
+        depth++;
+        if (newData == current->data) { // Duplicate, nothing to insert
+            takeBack(current->GetParent());
+            RBT_COUNT_DEPTH(depth);
+            inserted = false;
+            return current;
+        }
+        current->size++; // The new node will end up somewhere under here
         parent = current; // Update the current node's parent
-        if (node->data < current->data) { // If the new node is less than current node, move left
-            if (current->left == nullptr) break; // If there's no left child, we found the spot
-            current = current->left; // Otherwise, move to the left child
+        if (newData < current->data) { // If the new node is less than current node, move left
+            current = current->left;
         } else { // If the new node is more than current node, move right
-            //Similar to left
-            if (current->right == nullptr) break;
             current = current->right;
         }
     }
 
+    RBT_COUNT_DEPTH(depth);
+
+    // Create a new node using the struct. If the pool can't get more memory
+    // the tree has to be left as it was.
+    RBTNode* node;
+    try {
+        node = NewNode(newData, COLOR_RED);  // new nodes are red by default in Red Black Trees
+    } catch (...) {
+        takeBack(parent);
+        throw;
+    }
+    inserted = true;
+
+    if (parent == nullptr) {
+        StoreShared(root, node); // Assigning the node as the root of one doesn't exist
+        node->SetColor(COLOR_BLACK); // Root must always be black
+        StoreShared(leftmost, node);
+        StoreShared(rightmost, node);
+        return node;
+    }
+
     // After finding the correct parent, set the node's parent pointer
-    node->parent = parent;
+    node->SetParent(parent);
 
     // Attach the new node to the left or right of the parent, based on its value
-    if (node->data < parent->data) {
-        parent->left = node;
+    if (newData < parent->data) {
+        StoreShared(parent->left, node);
+        if (parent == leftmost) StoreShared(leftmost, node); // New smallest key
     } else {
-        parent->right = node;
+        StoreShared(parent->right, node);
+        if (parent == rightmost) StoreShared(rightmost, node); // New largest key
     }
+
+    // Nodes above where the walk started grew too
+    for (RBTNode *p = above; p != nullptr; p = p->GetParent()) {
+        p->size++;
+    }
+    return node;
 }
 
 // This function check red-black tree for violations after insert
-void RedBlackTree::InsertFixUp(RBTNode *node) {
-    while (node != root && node->parent->color == COLOR_RED) {
-        RBTNode *uncle = GetUncle(node);
-
-        if (IsLeftChild(node->parent)) {  // parent is left child
-            RBTNode *grandparent = node->parent->parent;
-            if (uncle != nullptr && uncle->color == COLOR_RED) {
-                // Case 1: uncle is red -> recolor
-                node->parent->color = COLOR_BLACK;
-                uncle->color = COLOR_BLACK;
-                grandparent->color = COLOR_RED;
-                node = grandparent;
-            } else {
-                if (IsRightChild(node)) {
-                    // Case 2: node is right child -> Left Rotate
-                    node = node->parent;
-                    LeftRotate(node);
-                }
-                // Case 3: node is left child -> Right Rotate
-                node->parent->color = COLOR_BLACK;
-                node->parent->parent->color = COLOR_RED;
-                RightRotate(node->parent->parent);
-            }
-        } else {  // parent is right child
-            RBTNode *grandparent = node->parent->parent;
-            if (uncle != nullptr && uncle->color == COLOR_RED) {
-                // Case 1 mirror: uncle is red -> recolor
-                node->parent->color = COLOR_BLACK;
-                uncle->color = COLOR_BLACK;
-                grandparent->color = COLOR_RED;
-                node = grandparent;
-            } else {
-                if (IsLeftChild(node)) {
-                    // Case 2 mirror: node is left child -> Right Rotate
-                    node = node->parent;
-                    RightRotate(node);
-                }
-                // Case 3 mirror: node is right child -> Left Rotate
-                node->parent->color = COLOR_BLACK;
-                node->parent->parent->color = COLOR_RED;
-                LeftRotate(node->parent->parent);
-            }
+bool RedBlackTree::InsertFixUp(RBTNode *node) {
+    return Core::InsertFixUp(root, node, Counters());
+}
+
+bool RedBlackTree::Remove(int data) {
+    RBTNode *node = Get(data);
+    if (node == nullptr) {
+        return false; // Nothing to remove
+    }
+    RemoveNode(node);
+    return true;
+}
+
+// Unlinks node from the tree, fixes the colors and gives the node back to the pool
+void RedBlackTree::RemoveNode(RBTNode *node) {
+    // Move the cached ends off the node before it goes away
+    if (node == leftmost) StoreShared(leftmost, const_cast<RBTNode *>(Successor(node)));
+    if (node == rightmost) StoreShared(rightmost, const_cast<RBTNode *>(Predecessor(node)));
+
+    Core::Unlink(root, node, Counters());
+    node->~RBTNode();
+    pool->Free(node); // The next insert reuses this node
+    numItems--;
+}
+
+RedBlackTree RedBlackTree::Join(RedBlackTree &&left, int pivot, RedBlackTree &&right) {
+    if ((left.root != nullptr && left.rightmost->data >= pivot) ||
+        (right.root != nullptr && right.leftmost->data <= pivot)) {
+        throw std::invalid_argument("Join needs left < pivot < right");
+    }
+    // Everything that can throw happens before either tree is touched
+    left.AdoptPool(right);
+    RBTNode *node = left.NewNode(pivot, COLOR_RED);
+    RedBlackTree result(std::move(left));
+
+    unsigned int height;
+    result.root = result.JoinRoots(result.root, BlackHeight(result.root), node,
+                                   right.root, BlackHeight(right.root), height);
+    result.leftmost = result.leftmost != nullptr ? result.leftmost : node;
+    result.rightmost = right.rightmost != nullptr ? right.rightmost : node;
+    result.numItems += right.numItems + 1;
+
+    right.root = right.leftmost = right.rightmost = nullptr;
+    right.numItems = 0;
+    right.pool.reset();
+    return result;
+}
+
+pair<RedBlackTree, RedBlackTree> RedBlackTree::Split(int data) {
+    RedBlackTree less;
+    RedBlackTree greater;
+    // The less half carries on with our pool and the greater half gets a
+    // pool of its own that keeps ours alive, so the halves can be handed to
+    // different threads (the pool isn't thread safe)
+    if (pool != nullptr) {
+        greater.Pool().Adopt(*pool);
+        less.pool = pool;
+    }
+
+    RBTNode *match = nullptr;
+    unsigned int lessHeight, greaterHeight;
+    SplitRoot(root, BlackHeight(root), data, less.root, lessHeight, greater.root, greaterHeight, match);
+    if (match != nullptr) {
+        match->~RBTNode();
+        less.Pool().Free(match);
+    }
+
+    less.numItems = SizeOf(less.root);
+    greater.numItems = SizeOf(greater.root);
+    less.FindEnds();
+    greater.FindEnds();
+    root = leftmost = rightmost = nullptr;
+    numItems = 0;
+    pool.reset(); // The less half has it to itself now
+    return make_pair(std::move(less), std::move(greater));
+}
+
+// Walks down the two spines to set leftmost and rightmost
+void RedBlackTree::FindEnds() {
+    leftmost = rightmost = root;
+    while (leftmost != nullptr && leftmost->left != nullptr) leftmost = leftmost->left;
+    while (rightmost != nullptr && rightmost->right != nullptr) rightmost = rightmost->right;
+}
+
+// Number of black nodes on any path from node down to a null (node included)
+unsigned int RedBlackTree::BlackHeight(const RBTNode *node) {
+    unsigned int height = 0;
+    for (; node != nullptr; node = node->left) {
+        if (node->GetColor() == COLOR_BLACK) height++;
+    }
+    return height;
+}
+
+// Links two detached subtrees with black roots under pivot and returns the new
+// root; height gets its black height. The shorter tree hangs off the spine of
+// the taller one at a black node of the same black height, with pivot as a red
+// node in between, so only a red-red fix up the spine is needed (InsertFixUp).
+// Uses root as scratch space while fixing up, then puts it back.
+RBTNode* RedBlackTree::JoinRoots(RBTNode *left, unsigned int leftHeight, RBTNode *pivot,
+                                 RBTNode *right, unsigned int rightHeight, unsigned int &height) {
+    RBTNode *savedRoot = root;
+    bool tallLeft = leftHeight >= rightHeight;
+    root = tallLeft ? left : right;
+    unsigned int target = tallLeft ? rightHeight : leftHeight;
+    height = tallLeft ? leftHeight : rightHeight;
+
+    // Go down the inner spine of the taller tree to a black node with the
+    // same black height as the shorter tree
+    RBTNode *parent = nullptr;
+    RBTNode *spot = root;
+    unsigned int spotHeight = height;
+    while (spot != nullptr && (spot->GetColor() == COLOR_RED || spotHeight > target)) {
+        if (spot->GetColor() == COLOR_BLACK) spotHeight--;
+        parent = spot;
+        spot = tallLeft ? spot->right : spot->left;
+    }
+
+    // pivot takes spot's place, with spot and the shorter tree as its children
+    RBTNode *shorter = tallLeft ? right : left;
+    pivot->left = tallLeft ? spot : shorter;
+    pivot->right = tallLeft ? shorter : spot;
+    pivot->SetParent(parent);
+    pivot->SetColor(COLOR_RED);
+    pivot->size = 1 + SizeOf(pivot->left) + SizeOf(pivot->right);
+    if (pivot->left != nullptr) pivot->left->SetParent(pivot);
+    if (pivot->right != nullptr) pivot->right->SetParent(pivot);
+
+    if (parent == nullptr) {
+        // Same black height: pivot is the new root, painted black
+        root = pivot;
+        pivot->SetColor(COLOR_BLACK);
+        height++;
+    } else {
+        if (tallLeft) {
+            parent->right = pivot;
+        } else {
+            parent->left = pivot;
+        }
+        // Everything above pivot gained pivot and the shorter tree
+        unsigned int added = 1 + SizeOf(shorter);
+        for (RBTNode *p = parent; p != nullptr; p = p->GetParent()) {
+            p->size += added;
+        }
+        if (parent->GetColor() == COLOR_RED && InsertFixUp(pivot)) {
+            height++;
         }
     }
-    root->color = COLOR_BLACK;
+
+    RBTNode *joined = root;
+    root = savedRoot;
+    return joined;
 }
 
-// Returns the uncle of a node
-RBTNode* RedBlackTree::GetUncle(RBTNode *node) const {
-    // Check if the node or its predecessor are null
-    if (node == nullptr || node->parent == nullptr || node->parent->parent == nullptr) {
-        return nullptr;
+// Splits the detached subtree under node (black height height) into the keys
+// less than data and greater than data, joining the pieces on the way back up.
+// match gets the node holding data, if there is one.
+void RedBlackTree::SplitRoot(RBTNode *node, unsigned int height, int data, RBTNode *&less, unsigned int &lessHeight,
+                             RBTNode *&greater, unsigned int &greaterHeight, RBTNode *&match) {
+    if (node == nullptr) {
+        less = greater = nullptr;
+        lessHeight = greaterHeight = 0;
+        return;
     }
-    // Check if the node's parent is a left child of its grandparent
-    if (IsLeftChild(node->parent)) {
-        // If the parent is a left child, the uncle is the right child of the grandparent
-        return node->parent->parent->right;
+
+    // Cut the children loose so they can be roots of their own
+    unsigned int childHeight = height - (node->GetColor() == COLOR_BLACK ? 1 : 0);
+    unsigned int childHeights[2] = {childHeight, childHeight};
+    RBTNode *children[2] = {DetachRoot(node->left, childHeights[0]), DetachRoot(node->right, childHeights[1])};
+    node->left = node->right = nullptr;
+
+    RBTNode *middle;
+    unsigned int middleHeight;
+    if (data < node->data) {
+        SplitRoot(children[0], childHeights[0], data, less, lessHeight, middle, middleHeight, match);
+        greater = JoinRoots(middle, middleHeight, node, children[1], childHeights[1], greaterHeight);
+    } else if (data > node->data) {
+        SplitRoot(children[1], childHeights[1], data, middle, middleHeight, greater, greaterHeight, match);
+        less = JoinRoots(children[0], childHeights[0], node, middle, middleHeight, lessHeight);
     } else {
-        // Otherwise, the uncle is the left child of the grandparent
-        return node->parent->parent->left;
+        less = children[0];
+        lessHeight = childHeights[0];
+        greater = children[1];
+        greaterHeight = childHeights[1];
+        match = node;
     }
 }
 
-// Returns true if node is a left child
-bool RedBlackTree::IsLeftChild(RBTNode *node) const {
-    return node->parent != nullptr && node->parent->left == node;
+// Makes node the root of its own tree: no parent, and painted black if it was
+// red (which makes it one black taller, so height gets bumped)
+RBTNode* RedBlackTree::DetachRoot(RBTNode *node, unsigned int &height) {
+    if (node != nullptr) {
+        node->SetParent(nullptr);
+        if (node->GetColor() == COLOR_RED) {
+            node->SetColor(COLOR_BLACK);
+            height++;
+        }
+    }
+    return node;
 }
 
-// Returns true if node is a right child
-bool RedBlackTree::IsRightChild(RBTNode *node) const {
-    return node->parent != nullptr && node->parent->right == node;
+// Join without a pivot key: the smallest node of right is split off and used
+RBTNode* RedBlackTree::JoinRoots(RBTNode *left, unsigned int leftHeight, RBTNode *right, unsigned int rightHeight,
+                                 unsigned int &height) {
+    if (left == nullptr) {
+        height = rightHeight;
+        return right;
+    }
+    if (right == nullptr) {
+        height = leftHeight;
+        return left;
+    }
+    const RBTNode *smallest = right;
+    while (smallest->left != nullptr) {
+        smallest = smallest->left;
+    }
+    RBTNode *none;
+    RBTNode *rest;
+    RBTNode *pivot = nullptr;
+    unsigned int noneHeight, restHeight;
+    SplitRoot(right, rightHeight, smallest->data, none, noneHeight, rest, restHeight, pivot);
+    return JoinRoots(left, leftHeight, pivot, rest, restHeight, height);
 }
 
-// Rotates the node to the left
-void RedBlackTree::LeftRotate(RBTNode *node) {
-    // Set the pivot node to be the right child of the node
-    RBTNode *pivot = node->right;
-    if (pivot == nullptr) return; //If the pivot is null, we can't perform the rotation, so return
+// Set operations split b around a's root and work on the two sides separately.
+// The sides share no nodes, so big ones go to another thread.
+static const size_t PARALLEL_GRAIN = 16384;
 
-    //Move the right child of the pivot to the left child of the node
-    node->right = pivot->left;
+// How many times the set operations may fork: enough for every hardware thread
+static unsigned int ParallelDepth() {
+    unsigned int threads = thread::hardware_concurrency();
+    unsigned int depth = 0;
+    while ((1u << depth) < threads) {
+        depth++;
+    }
+    return depth;
+}
 
-    //If the pivot's left child is not empty, update its parent's pointer
-    if (pivot->left != nullptr) {
-        pivot->left->parent = node;
+// Runs left on another thread while this one runs right, if parallel
+template <typename Left, typename Right>
+static void ForkJoin(bool parallel, Left left, Right right) {
+    if (!parallel) {
+        left();
+        right();
+        return;
     }
+    future<void> other = async(launch::async, left);
+    right();
+    other.get();
+}
 
-    //Adjust the parent pointer
-    pivot->parent = node->parent;
-    //If node has o parent, set the pivot as the root
-    if (node->parent == nullptr) {
-        root = pivot;
-    // If not, adjust the parent's left or right pointer to point to the pivot
-    } else if (IsLeftChild(node)) {
-        node->parent->left = pivot;
-    } else {
-        node->parent->right = pivot;
+RedBlackTree RedBlackTree::Union(RedBlackTree &&a, RedBlackTree &&b) {
+    return RunSetOperation(a, b, &RedBlackTree::UnionRoots);
+}
+
+RedBlackTree RedBlackTree::Intersection(RedBlackTree &&a, RedBlackTree &&b) {
+    return RunSetOperation(a, b, &RedBlackTree::IntersectRoots);
+}
+
+RedBlackTree RedBlackTree::Difference(RedBlackTree &&a, RedBlackTree &&b) {
+    return RunSetOperation(a, b, &RedBlackTree::DifferenceRoots);
+}
+
+// Moves both trees' nodes into one result and runs operation on the roots.
+// Nodes the result doesn't keep are collected while the threads run and only
+// given back to the pool at the end, since the pool isn't thread safe.
+RedBlackTree RedBlackTree::RunSetOperation(RedBlackTree &a, RedBlackTree &b, SetOperation operation) {
+    a.AdoptPool(b);
+    RedBlackTree result(std::move(a));
+
+    vector<RBTNode *> garbage;
+    unsigned int height;
+    RBTNode *bRoot = b.root;
+    b.root = b.leftmost = b.rightmost = nullptr;
+    b.numItems = 0;
+    b.pool.reset();
+    RBTNode *aRoot = result.root;
+    result.root = nullptr;
+    result.root = (result.*operation)(aRoot, BlackHeight(aRoot), bRoot, BlackHeight(bRoot),
+                                      height, garbage, ParallelDepth());
+
+    for (RBTNode *node : garbage) {
+        result.DeleteTree(node);
+    }
+    result.numItems = SizeOf(result.root);
+    result.FindEnds();
+    return result;
+}
+
+RBTNode* RedBlackTree::UnionRoots(RBTNode *a, unsigned int aHeight, RBTNode *b, unsigned int bHeight,
+                                  unsigned int &height, vector<RBTNode *> &garbage, unsigned int depth) {
+    if (a == nullptr) {
+        height = bHeight;
+        return b;
+    }
+    if (b == nullptr) {
+        height = aHeight;
+        return a;
+    }
+
+    // Split b around a's root; a's root is black, so its children are one shorter
+    unsigned int aLeftHeight = aHeight - 1, aRightHeight = aHeight - 1;
+    RBTNode *aLeft = DetachRoot(a->left, aLeftHeight);
+    RBTNode *aRight = DetachRoot(a->right, aRightHeight);
+    a->left = a->right = nullptr;
+    RBTNode *bLess, *bGreater, *match = nullptr;
+    unsigned int bLessHeight, bGreaterHeight;
+    SplitRoot(b, bHeight, a->data, bLess, bLessHeight, bGreater, bGreaterHeight, match);
+    if (match != nullptr) {
+        garbage.push_back(match); // Already have that key
     }
 
-    pivot->left = node; // the node now finally becomes the left child of the pivot
-    node->parent = pivot; // the parent of the node is now the pivot
+    RBTNode *left, *right;
+    unsigned int leftHeight, rightHeight;
+    vector<RBTNode *> leftGarbage;
+    bool parallel = depth > 0 && SizeOf(aLeft) + SizeOf(bLess) + SizeOf(aRight) + SizeOf(bGreater) >= PARALLEL_GRAIN;
+    ForkJoin(parallel,
+        [&]() {
+            RedBlackTree scratch; // JoinRoots uses root as scratch space, so each thread needs its own
+            left = scratch.UnionRoots(aLeft, aLeftHeight, bLess, bLessHeight, leftHeight, leftGarbage, depth - parallel);
+            AddStats(scratch);
+        },
+        [&]() {
+            right = UnionRoots(aRight, aRightHeight, bGreater, bGreaterHeight, rightHeight, garbage, depth - parallel);
+        });
+    garbage.insert(garbage.end(), leftGarbage.begin(), leftGarbage.end());
+
+    return JoinRoots(left, leftHeight, a, right, rightHeight, height);
 }
 
-// Rotates the node to the right
-void RedBlackTree::RightRotate(RBTNode *node) {
-    //Similarly to left just the inverse 
-    RBTNode *pivot = node->left;
-    if (pivot == nullptr) return; 
+RBTNode* RedBlackTree::IntersectRoots(RBTNode *a, unsigned int aHeight, RBTNode *b, unsigned int bHeight,
+                                      unsigned int &height, vector<RBTNode *> &garbage, unsigned int depth) {
+    if (a == nullptr || b == nullptr) {
+        // Nothing in common, whatever is left goes
+        if (a != nullptr) garbage.push_back(a);
+        if (b != nullptr) garbage.push_back(b);
+        height = 0;
+        return nullptr;
+    }
+
+    unsigned int aLeftHeight = aHeight - 1, aRightHeight = aHeight - 1;
+    RBTNode *aLeft = DetachRoot(a->left, aLeftHeight);
+    RBTNode *aRight = DetachRoot(a->right, aRightHeight);
+    a->left = a->right = nullptr;
+    RBTNode *bLess, *bGreater, *match = nullptr;
+    unsigned int bLessHeight, bGreaterHeight;
+    SplitRoot(b, bHeight, a->data, bLess, bLessHeight, bGreater, bGreaterHeight, match);
+
+    RBTNode *left, *right;
+    unsigned int leftHeight, rightHeight;
+    vector<RBTNode *> leftGarbage;
+    bool parallel = depth > 0 && SizeOf(aLeft) + SizeOf(bLess) + SizeOf(aRight) + SizeOf(bGreater) >= PARALLEL_GRAIN;
+    ForkJoin(parallel,
+        [&]() {
+            RedBlackTree scratch;
+            left = scratch.IntersectRoots(aLeft, aLeftHeight, bLess, bLessHeight, leftHeight, leftGarbage, depth - parallel);
+            AddStats(scratch);
+        },
+        [&]() {
+            right = IntersectRoots(aRight, aRightHeight, bGreater, bGreaterHeight, rightHeight, garbage, depth - parallel);
+        });
+    garbage.insert(garbage.end(), leftGarbage.begin(), leftGarbage.end());
 
-    node->left = pivot->right;
-    if (pivot->right != nullptr) {
-        pivot->right->parent = node;
+    if (match != nullptr) {
+        garbage.push_back(match); // Keep a's copy of the key
+        return JoinRoots(left, leftHeight, a, right, rightHeight, height);
     }
+    garbage.push_back(a); // Key only in a, it goes
+    return JoinRoots(left, leftHeight, right, rightHeight, height);
+}
 
-    pivot->parent = node->parent;
-    if (node->parent == nullptr) {
-        root = pivot;
-    } else if (IsRightChild(node)) {
-        node->parent->right = pivot;
-    } else {
-        node->parent->left = pivot;
+RBTNode* RedBlackTree::DifferenceRoots(RBTNode *a, unsigned int aHeight, RBTNode *b, unsigned int bHeight,
+                                       unsigned int &height, vector<RBTNode *> &garbage, unsigned int depth) {
+    if (a == nullptr || b == nullptr) {
+        if (b != nullptr) garbage.push_back(b); // Nothing left to take it away from
+        height = aHeight;
+        return a;
+    }
+
+    // This time a gets split around b's root, which is never kept
+    unsigned int bLeftHeight = bHeight - 1, bRightHeight = bHeight - 1;
+    RBTNode *bLeft = DetachRoot(b->left, bLeftHeight);
+    RBTNode *bRight = DetachRoot(b->right, bRightHeight);
+    b->left = b->right = nullptr;
+    garbage.push_back(b);
+    RBTNode *aLess, *aGreater, *match = nullptr;
+    unsigned int aLessHeight, aGreaterHeight;
+    SplitRoot(a, aHeight, b->data, aLess, aLessHeight, aGreater, aGreaterHeight, match);
+    if (match != nullptr) {
+        garbage.push_back(match);
     }
 
-    pivot->right = node;
-    node->parent = pivot;
+    RBTNode *left, *right;
+    unsigned int leftHeight, rightHeight;
+    vector<RBTNode *> leftGarbage;
+    bool parallel = depth > 0 && SizeOf(aLess) + SizeOf(bLeft) + SizeOf(aGreater) + SizeOf(bRight) >= PARALLEL_GRAIN;
+    ForkJoin(parallel,
+        [&]() {
+            RedBlackTree scratch;
+            left = scratch.DifferenceRoots(aLess, aLessHeight, bLeft, bLeftHeight, leftHeight, leftGarbage, depth - parallel);
+            AddStats(scratch);
+        },
+        [&]() {
+            right = DifferenceRoots(aGreater, aGreaterHeight, bRight, bRightHeight, rightHeight, garbage, depth - parallel);
+        });
+    garbage.insert(garbage.end(), leftGarbage.begin(), leftGarbage.end());
+
+    return JoinRoots(left, leftHeight, right, rightHeight, height);
 }
 
 // Search for a node with the given data
 RBTNode* RedBlackTree::Get(int data) const {
     RBTNode *current = root;
+    size_t depth = 0;
+    RBT_COUNT(searches);
     //Similar principle to a binary tree
 
     while (current != nullptr) {
+        depth++;
         if (data == current->data) {
+            RBT_COUNT_DEPTH(depth);
             return current;
         } else if (data < current->data) { //If it is smaller, move to the left
             current = current->left;
@@ -371,24 +1304,142 @@ RBTNode* RedBlackTree::Get(int data) const {
             current = current->right;
         }
     }
+    RBT_COUNT_DEPTH(depth);
     return nullptr; // Not found
 }
 
-// Destructor to delete the entire tree
-RedBlackTree::~RedBlackTree() {
-    DeleteTree(root);  // Call the helper function to delete all nodes
+// Batches are looked up this many keys at a time, so no allocation is needed
+static const size_t BATCH_CHUNK = 256;
+// How many searches run side by side in GetInterleaved
+static const size_t BATCH_LANES = 16;
+// No red black tree we can address is taller than this
+static const size_t MAX_TREE_HEIGHT = 128;
+
+void RedBlackTree::ContainsBatch(span<const int> keys, span<bool> found) const {
+    if (found.size() < keys.size()) {
+        throw std::invalid_argument("ContainsBatch needs one output per key");
+    }
+    const RBTNode *nodes[BATCH_CHUNK];
+    for (size_t start = 0; start < keys.size(); start += BATCH_CHUNK) {
+        size_t count = min(BATCH_CHUNK, keys.size() - start);
+        GetBatch(keys.data() + start, count, nodes);
+        for (size_t i = 0; i < count; i++) {
+            found[start + i] = nodes[i] != nullptr;
+        }
+    }
 }
 
-// Helper function to delete all nodes
-void RedBlackTree::DeleteTree(RBTNode* node) {
-    if (node == nullptr) {
-        return;
+void RedBlackTree::FindBatch(span<const int> keys, span<Iterator> found) const {
+    if (found.size() < keys.size()) {
+        throw std::invalid_argument("FindBatch needs one output per key");
+    }
+    const RBTNode *nodes[BATCH_CHUNK];
+    for (size_t start = 0; start < keys.size(); start += BATCH_CHUNK) {
+        size_t count = min(BATCH_CHUNK, keys.size() - start);
+        GetBatch(keys.data() + start, count, nodes);
+        for (size_t i = 0; i < count; i++) {
+            found[start + i] = Iterator(nodes[i], this);
+        }
+    }
+}
+
+// Picks the batch strategy: sorted keys reuse their shared path prefix,
+// anything else gets interleaved searches
+void RedBlackTree::GetBatch(const int *keys, size_t count, const RBTNode **found) const {
+    bool sorted = true;
+    for (size_t i = 1; i < count && sorted; i++) {
+        sorted = keys[i - 1] <= keys[i];
+    }
+    if (sorted) {
+        GetSortedBatch(keys, count, found);
+    } else {
+        for (size_t start = 0; start < count; start += BATCH_LANES) {
+            GetInterleaved(keys + start, min(BATCH_LANES, count - start), found + start);
+        }
+    }
+}
+
+// Keys go up, so the next search can start from the deepest node on the last
+// search path whose subtree can still hold the key, instead of from the root.
+// Every node on the path remembers the upper bound of its subtree: the key of
+// the nearest ancestor where the path went left.
+void RedBlackTree::GetSortedBatch(const int *keys, size_t count, const RBTNode **found) const {
+    const RBTNode *path[MAX_TREE_HEIGHT];
+    long long upper[MAX_TREE_HEIGHT];
+    size_t depth = 0;
+    if (root != nullptr) {
+        path[0] = root;
+        upper[0] = LLONG_MAX;
+        depth = 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        int key = keys[i];
+        found[i] = nullptr;
+        // Back up to the deepest node whose subtree can hold key (the root always can)
+        while (depth > 1 && key >= upper[depth - 1]) {
+            depth--;
+        }
+        while (depth > 0) {
+            const RBTNode *node = path[depth - 1];
+            if (key == node->data) {
+                found[i] = node;
+                break;
+            }
+            const RBTNode *next;
+            long long nextUpper;
+            if (key < node->data) {
+                next = node->left;
+                nextUpper = node->data;
+            } else {
+                next = node->right;
+                nextUpper = upper[depth - 1];
+            }
+            if (next == nullptr) {
+                break; // Not in the tree, the path stays here for the next key
+            }
+            path[depth] = next;
+            upper[depth] = nextUpper;
+            depth++;
+        }
     }
+}
+
+// Runs up to BATCH_LANES searches one level at a time, prefetching the next
+// node of each, so the cache misses of different keys overlap
+void RedBlackTree::GetInterleaved(const int *keys, size_t count, const RBTNode **found) const {
+    const RBTNode *current[BATCH_LANES];
+    size_t active = 0;
+    for (size_t lane = 0; lane < count; lane++) {
+        found[lane] = nullptr;
+        current[lane] = root;
+        if (root != nullptr) active++;
+    }
+
+    while (active > 0) {
+        for (size_t lane = 0; lane < count; lane++) {
+            const RBTNode *node = current[lane];
+            if (node == nullptr) continue; // This search is already done
 
-    // Recursively delete the left and right subtrees
-    DeleteTree(node->left);
-    DeleteTree(node->right);
+            if (keys[lane] == node->data) {
+                found[lane] = node;
+                node = nullptr;
+            } else {
+                node = keys[lane] < node->data ? node->left : node->right;
+            }
+            current[lane] = node;
+            if (node != nullptr) {
+                __builtin_prefetch(node);
+            } else {
+                active--;
+            }
+        }
+    }
+}
 
-    // Delete the current node
-    delete node;
-}
\ No newline at end of file
+// Destructor to delete the entire tree
+RedBlackTree::~RedBlackTree() {
+    // Nodes are plain data, so dropping the pool frees the whole tree without
+    // visiting every node. No other tree allocates from our pool (Split, Join
+    // and the set operations only adopt pools), so nothing else needs it.
+}
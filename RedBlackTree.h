@@ -2,73 +2,335 @@
 #define REDBLACKTREE_H
 
 
-#define COLOR_RED 0
-#define COLOR_BLACK 1
-#define COLOR_DOUBLE_BLACK 2
-
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "NodePool.h"
+#include "RedBlackCore.h"
 
 using namespace std;
 
 
-struct RBTNode {
-	int data;
-	unsigned short int color;
-	RBTNode *left = nullptr;
-	RBTNode *right = nullptr;
-	RBTNode *parent = nullptr;
-	bool IsNullNode = false;
+typedef BasicRBTNode<int> RBTNode;
+typedef BasicNodePool<RBTNode> NodePool;
+
+// What RedBlackTree::Stats() returns. The counters are only kept when the
+// tree is built with -DRBT_STATS; otherwise they cost nothing and stay zero.
+template <typename Counter>
+struct BasicTreeStats {
+	static const int DEPTH_BUCKETS = 64; // deeper searches land in the last bucket
+
+	Counter leftRotations{};
+	Counter rightRotations{};
+	Counter fixupIterations{};  // trips through the InsertFixUp loop
+	Counter fixupRecolors{};    // red uncle: just recolor and move up
+	Counter fixupRotations{};   // black uncle: rotate (once or twice) and stop
+	Counter searches{};         // Get and BasicInsert walks
+	Counter depthHistogram[DEPTH_BUCKETS] = {}; // searches by how many nodes they looked at
+	Counter nodeAllocations{};
+};
+typedef BasicTreeStats<unsigned long long> RedBlackTreeStats;
+
+// What RedBlackTree::Validate() found
+struct RedBlackTreeReport {
+	bool valid = true;
+	string error;            // first broken rule, empty if valid
+	size_t height = 0;       // nodes on the longest root to leaf path
+	size_t blackHeight = 0;  // black nodes on every root to leaf path
+	double averageDepth = 0; // average edges from the root to a node
 };
 
+class FrozenRedBlackTree;
+
 
 class RedBlackTree {
 	
 	public:
+		// Read-only bidirectional iterator over the keys in sorted order.
+		// Steps with the parent pointers, so it never allocates.
+		class Iterator {
+			public:
+				typedef bidirectional_iterator_tag iterator_category;
+				typedef int value_type;
+				typedef ptrdiff_t difference_type;
+				typedef const int *pointer;
+				typedef const int &reference;
+
+				Iterator() {}
+				reference operator*() const { return node->data; }
+				pointer operator->() const { return &node->data; }
+				Iterator &operator++() { node = Successor(node); return *this; }
+				Iterator operator++(int) { Iterator old = *this; ++*this; return old; }
+				// Stepping back from end() lands on the largest key
+				Iterator &operator--() { node = node == nullptr ? tree->MaxNode() : Predecessor(node); return *this; }
+				Iterator operator--(int) { Iterator old = *this; --*this; return old; }
+				bool operator==(const Iterator &other) const { return node == other.node; }
+				bool operator!=(const Iterator &other) const { return node != other.node; }
+
+			private:
+				friend class RedBlackTree;
+				Iterator(const RBTNode *node, const RedBlackTree *tree) : node(node), tree(tree) {}
+				const RBTNode *node = nullptr; // nullptr means end()
+				const RedBlackTree *tree = nullptr;
+		};
+		typedef Iterator iterator;
+		typedef Iterator const_iterator;
+
 		RedBlackTree();
 		RedBlackTree(int newData);
 		RedBlackTree(const RedBlackTree &rbt);
+		RedBlackTree(RedBlackTree &&rbt) noexcept;
+		RedBlackTree &operator=(const RedBlackTree &rbt);
+		RedBlackTree &operator=(RedBlackTree &&rbt) noexcept;
 		~RedBlackTree();  // Declaring the destructor
 
-		string ToInfixString() const {return ToInfixString(root);};
-		string ToPrefixString() const { return ToPrefixString(root);};
-		string ToPostfixString() const { return ToPostfixString(root);};
+		// Builds a balanced tree from strictly increasing keys in O(n),
+		// with all the nodes in one contiguous block
+		template <typename It>
+		static RedBlackTree BuildFromSorted(It first, It last) {
+			return RedBlackTree(SortedTag(), first, last);
+		}
 
+		string ToInfixString() const;
+		string ToPrefixString() const;
+		string ToPostfixString() const;
+
+		// Same output as the ToString functions, written straight into out
+		void WriteInfix(ostream &out) const;
+		void WritePrefix(ostream &out) const;
+		void WritePostfix(ostream &out) const;
+
+		// Writes one node the way the functions above show it (" B30 ") and
+		// returns the end. out needs room for MAX_NODE_CHARS.
+		static const size_t MAX_NODE_CHARS = 16; // " DB-2147483648 "
+		// What the ToString functions reserve per node: about right for small
+		// keys, saves most regrowth
+		static const size_t STRING_CHARS_PER_NODE = 8;
+		static char *FormatNode(char *out, unsigned short int color, int data);
+
+		// A key past the current max (or min) skips the search from the root
+		// and goes straight under that end node
 		void Insert(int newData);
+		// Same as Insert but returns false on a duplicate instead of throwing
+		bool TryInsert(int newData);
+		// Insert that starts looking from hint instead of the root; cheap when
+		// newData is close to *hint (end() means close to the max). Returns
+		// where newData went, which makes a good hint for the next key.
+		Iterator Insert(Iterator hint, int newData);
+		// Inserts a batch of keys, fastest when they come in sorted order:
+		// each key starts its search from where the previous one landed (or
+		// right under the max when it's past it). Input iterators work too,
+		// they just don't get the batch reserved up front.
+		// Duplicates are skipped (and appended to duplicates if given) instead
+		// of throwing. Returns how many keys were actually inserted.
+		template <typename It>
+		size_t InsertRange(It first, It last, vector<int> *duplicates = nullptr);
+		// Returns false if data wasn't in the tree
+		bool Remove(int data);
+
+		// Links left, pivot and right into one tree in O(log n) without copying
+		// nodes. Every key in left must be < pivot < every key in right.
+		// left and right are left empty.
+		static RedBlackTree Join(RedBlackTree &&left, int pivot, RedBlackTree &&right);
+		// Splits into (keys < data, keys > data) in O(log n); data itself is
+		// dropped. This tree is left empty.
+		pair<RedBlackTree, RedBlackTree> Split(int data);
+
+		// Set operations built on Split/Join. Both trees are consumed (left
+		// empty) and their nodes reused in the result; pass copies to keep them.
+		// Big inputs are worked on in parallel, one thread per independent pair
+		// of subtrees.
+		static RedBlackTree Union(RedBlackTree &&a, RedBlackTree &&b);
+		static RedBlackTree Intersection(RedBlackTree &&a, RedBlackTree &&b);
+		// Keys of a that aren't in b
+		static RedBlackTree Difference(RedBlackTree &&a, RedBlackTree &&b);
 
 		bool Contains(int data) const ;
+		// Looks up many keys at once: found[i] = Contains(keys[i]).
+		// Sorted batches share the top of their search paths, other batches
+		// run several searches side by side with prefetching.
+		void ContainsBatch(span<const int> keys, span<bool> found) const;
+		// Same, but found[i] = find(keys[i])
+		void FindBatch(span<const int> keys, span<Iterator> found) const;
 		size_t Size() const {return numItems;};
+		// Removes every key but keeps the pool's memory for the next inserts
+		void Clear();
 		int GetMin() const;
 		int GetMax() const;
+		// k-th smallest key, counting from 0
+		int Select(size_t k) const;
+		// How many keys are < data
+		size_t Rank(int data) const;
+		// How many keys are in [low, high)
+		size_t CountInRange(int low, int high) const;
+
+		// Remove and return the smallest/largest key
+		int PopMin();
+		int PopMax();
+
+		Iterator begin() const;
+		Iterator end() const { return Iterator(nullptr, this); }
+		Iterator find(int data) const { return Iterator(Get(data), this); }
+		// First key >= data
+		Iterator lower_bound(int data) const;
+		// First key > data
+		Iterator upper_bound(int data) const;
+		// Keys in [lower_bound(data), upper_bound(data)), so at most one
+		pair<Iterator, Iterator> equal_range(int data) const;
+
+		// Read-only copy of the keys packed into one array for faster lookups
+		// (see FrozenRedBlackTree.h). Thaw() on it gives a tree back.
+		FrozenRedBlackTree Freeze() const;
+
+		// Copy of the hot path counters (all zero unless built with RBT_STATS).
+		// Copies and moved-to trees start counting from zero.
+		RedBlackTreeStats Stats() const;
+		static const bool STATS_ENABLED;
+
+		// Checks every red black and bookkeeping rule in one O(n) pass without
+		// recursion, and measures how balanced the tree is
+		RedBlackTreeReport Validate() const;
+
+		// Writes the keys to path in a binary snapshot: a header (magic,
+		// count, checksum) and then the keys in ascending order.
+		// Load maps the file into memory, checks it and builds the tree in
+		// O(n). Both throw runtime_error if the file can't be used.
+		void Save(const string &path) const;
+		static RedBlackTree Load(const string &path);
 		
 	
 	private: 
+		// Reads nodes directly for its lock-free lookups
+		friend class ConcurrentRedBlackTree;
+
+		struct SortedTag {};
+		template <typename It>
+		RedBlackTree(SortedTag, It first, It last);
+
 		unsigned long long int numItems  = 0;
 		RBTNode *root = nullptr;
+		RBTNode *leftmost = nullptr;  // cached min node, kept up to date by insert/remove
+		RBTNode *rightmost = nullptr; // cached max node
+		// Every node of this tree lives in here (or in a pool it adopted).
+		// Only this tree allocates from it, so halves of a Split can go to
+		// different threads. Made on first use.
+		shared_ptr<NodePool> pool;
+#ifdef RBT_STATS
+		// Relaxed atomics: a parallel set operation counts into these from the
+		// thread running the right branch while the left branch's scratch tree
+		// gets added in from another (see AddStats)
+		mutable BasicTreeStats<atomic<unsigned long long>> stats;
+#endif
+		void AddStats(const RedBlackTree &scratch);
 		
-		static string ToInfixString(const RBTNode *n);
-		static string ToPrefixString(const RBTNode *n);
-		static string ToPostfixString(const RBTNode *n);
-		
-		static string GetColorString(const RBTNode *n);
-		static string GetNodeString(const RBTNode *n);
-		
-		void BasicInsert(RBTNode *node);
-		void InsertFixUp(RBTNode *node);
-		
-		RBTNode *GetUncle(RBTNode *node) const;
-		
-		bool IsLeftChild(RBTNode *node) const;
-		bool IsRightChild(RBTNode *node) const;
-		
-		void LeftRotate(RBTNode *node);
-		void RightRotate(RBTNode *node);
+		static char *WriteNode(char *out, const RBTNode *n);
 		
+		RBTNode *BasicInsert(int newData, bool &inserted, RBTNode *start = nullptr);
+		RBTNode *InsertFrom(RBTNode *start, int newData, bool &inserted);
+		RBTNode *ClimbFrom(RBTNode *finger, int newData) const;
+		RBTNode *EndFor(int newData) const;
+		RBTNode *StartFor(RBTNode *finger, int newData) const;
+		bool InsertFixUp(RBTNode *node);
+		void RemoveNode(RBTNode *node);
+
+		// The balancing code is shared with RedBlackMap (see RedBlackCore.h)
+		typedef RedBlackCore<RBTNode> Core;
+		static bool IsBlack(const RBTNode *node) { return Core::IsBlack(node); }
+		static unsigned int SizeOf(const RBTNode *node) { return Core::SizeOf(node); }
+#ifdef RBT_STATS
+		// Feeds the shared algorithms' rotations and fixup cases into stats
+		struct StatsCounters {
+			BasicTreeStats<atomic<unsigned long long>> &stats;
+			void LeftRotation() { stats.leftRotations.fetch_add(1, memory_order_relaxed); }
+			void RightRotation() { stats.rightRotations.fetch_add(1, memory_order_relaxed); }
+			void FixupIteration() { stats.fixupIterations.fetch_add(1, memory_order_relaxed); }
+			void FixupRecolor() { stats.fixupRecolors.fetch_add(1, memory_order_relaxed); }
+			void FixupRotation() { stats.fixupRotations.fetch_add(1, memory_order_relaxed); }
+		};
+		StatsCounters Counters() const { return StatsCounters{stats}; }
+#else
+		NoTreeCounters Counters() const { return NoTreeCounters(); }
+#endif
+
+		NodePool &Pool();
+		void AdoptPool(RedBlackTree &rbt);
+		RBTNode *NewNode(int data, unsigned short int color);
+		void LinkSorted(RBTNode *nodes, size_t count);
+		static RBTNode *LinkRange(RBTNode *nodes, size_t low, size_t high, unsigned int depth, unsigned int redDepth);
 		RBTNode *CopyOf(const RBTNode *node);
+		void DeleteTree(RBTNode *node);
+		void FindEnds();
+		static unsigned int BlackHeight(const RBTNode *node);
+		RBTNode *JoinRoots(RBTNode *left, unsigned int leftHeight, RBTNode *pivot,
+		                   RBTNode *right, unsigned int rightHeight, unsigned int &height);
+		void SplitRoot(RBTNode *node, unsigned int height, int data, RBTNode *&less, unsigned int &lessHeight,
+		               RBTNode *&greater, unsigned int &greaterHeight, RBTNode *&match);
+		static RBTNode *DetachRoot(RBTNode *node, unsigned int &height);
+		RBTNode *JoinRoots(RBTNode *left, unsigned int leftHeight, RBTNode *right, unsigned int rightHeight,
+		                   unsigned int &height);
 
-		RBTNode *Get(int data) const;
+		typedef RBTNode *(RedBlackTree::*SetOperation)(RBTNode *a, unsigned int aHeight, RBTNode *b, unsigned int bHeight,
+		                                               unsigned int &height, vector<RBTNode *> &garbage, unsigned int depth);
+		static RedBlackTree RunSetOperation(RedBlackTree &a, RedBlackTree &b, SetOperation operation);
+		RBTNode *UnionRoots(RBTNode *a, unsigned int aHeight, RBTNode *b, unsigned int bHeight,
+		                    unsigned int &height, vector<RBTNode *> &garbage, unsigned int depth);
+		RBTNode *IntersectRoots(RBTNode *a, unsigned int aHeight, RBTNode *b, unsigned int bHeight,
+		                        unsigned int &height, vector<RBTNode *> &garbage, unsigned int depth);
+		RBTNode *DifferenceRoots(RBTNode *a, unsigned int aHeight, RBTNode *b, unsigned int bHeight,
+		                         unsigned int &height, vector<RBTNode *> &garbage, unsigned int depth);
+		void Steal(RedBlackTree &rbt);
 
-		// Helper function to delete all nodes
-		void DeleteTree(RBTNode* node);
+		RBTNode *Get(int data) const;
+		void GetBatch(const int *keys, size_t count, const RBTNode **found) const;
+		void GetSortedBatch(const int *keys, size_t count, const RBTNode **found) const;
+		void GetInterleaved(const int *keys, size_t count, const RBTNode **found) const;
+		RBTNode *MinNode() const { return leftmost; }
+		RBTNode *MaxNode() const { return rightmost; }
+		static const RBTNode *Successor(const RBTNode *node) { return Core::Successor(node); }
+		static const RBTNode *Predecessor(const RBTNode *node) { return Core::Predecessor(node); }
 };
 
+// Fills one block with the keys in order, then LinkSorted wires it into a tree
+template <typename It>
+RedBlackTree::RedBlackTree(SortedTag, It first, It last) {
+	size_t count = distance(first, last);
+	RBTNode *nodes = Pool().AllocateBlock(count);
+	for (size_t i = 0; first != last; ++first, ++i) {
+		new (&nodes[i]) RBTNode();
+		nodes[i].data = *first;
+		if (i > 0 && nodes[i - 1].data >= nodes[i].data) {
+			throw invalid_argument("BuildFromSorted needs strictly increasing keys");
+		}
+	}
+	LinkSorted(nodes, count);
+}
+
+template <typename It>
+size_t RedBlackTree::InsertRange(It first, It last, vector<int> *duplicates) {
+	if constexpr (forward_iterator<It>) {
+		Pool().Reserve(distance(first, last)); // One slab for the whole batch
+	}
+	size_t added = 0;
+	RBTNode *finger = nullptr;
+	for (; first != last; ++first) {
+		int key = *first;
+		bool inserted = false;
+		finger = InsertFrom(StartFor(finger, key), key, inserted);
+		if (inserted) {
+			added++;
+		} else if (duplicates != nullptr) {
+			duplicates->push_back(key);
+		}
+	}
+	return added;
+}
+
 #endif
@@ -0,0 +1,212 @@
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdlib>
+#include <climits>
+#include <thread>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "RedBlackTree.h"
+#include "WideNodeTree.h"
+#include "ShardedRedBlackTree.h"
+
+using namespace std;
+
+// Benchmarks IntSet (RedBlackTree, or WideNodeTree when built with
+// -DRBT_USE_WIDE_NODES) against std::set<int>, then times ShardedRedBlackTree
+// inserts from 1, 2, 4 ... up to one thread per core.
+// Usage: ./rbt-bench [size...]   e.g. ./rbt-bench 1000 100000000
+// Every engine/size pair runs in its own child process so the peak RSS it
+// reports belongs to that run alone.
+
+// std::set with the same method names as our trees
+class StdSet {
+	public:
+		void Insert(int key) { keys.insert(key); }
+		bool Contains(int key) const { return keys.count(key) != 0; }
+		int GetMin() const { return *keys.begin(); }
+		int GetMax() const { return *keys.rbegin(); }
+		size_t Size() const { return keys.size(); }
+	private:
+		set<int> keys;
+};
+
+// Written to after every timed loop so the compiler can't drop the work
+static volatile long long sink;
+
+// Makes the compiler assume memory changed, so a loop of identical calls
+// can't be folded into one
+static inline void Clobber(){
+	asm volatile("" : : : "memory");
+}
+
+class Timer {
+	public:
+		Timer() : start(chrono::steady_clock::now()) {}
+		double Seconds() const {
+			return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		}
+	private:
+		chrono::steady_clock::time_point start;
+};
+
+static void Report(const char *engine, const char *operation, size_t n, size_t ops, double seconds){
+	double nsPerOp = seconds * 1e9 / ops;
+	cout << left << setw(14) << engine << setw(20) << operation << right << setw(11) << n
+		 << fixed << setprecision(1) << setw(12) << nsPerOp << " ns/op"
+		 << setprecision(2) << setw(10) << ops / seconds / 1e6 << " Mops/s" << endl;
+}
+
+static long PeakRssKb(){
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss; // Kilobytes on Linux
+}
+
+template <typename Set>
+static void BuildInOrder(const char *engine, const char *operation, const vector<int> &keys){
+	Timer timer;
+	Set set;
+	for (int key : keys) set.Insert(key);
+	double seconds = timer.Seconds();
+	sink = set.Size();
+	Report(engine, operation, keys.size(), keys.size(), seconds);
+}
+
+template <typename Set>
+static void RunSuite(const char *engine, size_t n){
+	// Hits are the even numbers below 2n in random order, misses the odd ones
+	vector<int> keys(n);
+	for (size_t i = 0; i < n; i++) keys[i] = 2 * i;
+	vector<int> ascending = keys;
+	vector<int> descending(keys.rbegin(), keys.rend());
+	mt19937 gen(42);
+	shuffle(keys.begin(), keys.end(), gen);
+
+	BuildInOrder<Set>(engine, "insert ascending", ascending);
+	BuildInOrder<Set>(engine, "insert descending", descending);
+	ascending = vector<int>();
+	descending = vector<int>();
+
+	unique_ptr<Set> set(new Set());
+	Timer insertTimer;
+	for (int key : keys) set->Insert(key);
+	Report(engine, "insert random", n, n, insertTimer.Seconds());
+
+	long long found = 0;
+	Timer hitTimer;
+	for (int key : keys) found += set->Contains(key);
+	Report(engine, "contains hit", n, n, hitTimer.Seconds());
+
+	Timer missTimer;
+	for (int key : keys) found += set->Contains(key + 1);
+	Report(engine, "contains miss", n, n, missTimer.Seconds());
+	sink = found;
+
+	const size_t extremes = 1000000;
+	long long total = 0;
+	Timer extremeTimer;
+	for (size_t i = 0; i < extremes; i++) {
+		total += set->GetMin() + set->GetMax();
+		Clobber();
+	}
+	sink = total;
+	Report(engine, "GetMin+GetMax", n, extremes, extremeTimer.Seconds());
+
+	if constexpr (is_copy_constructible<Set>::value) {
+		Timer copyTimer;
+		Set copy(*set);
+		Report(engine, "copy", n, n, copyTimer.Seconds());
+		sink = copy.Size();
+	}
+
+	if constexpr (requires(const Set &s) { s.ToInfixString(); }) {
+		Timer stringTimer;
+		string infix = set->ToInfixString();
+		Report(engine, "ToInfixString", n, n, stringTimer.Seconds());
+		sink = infix.size();
+	}
+
+	Timer destroyTimer;
+	set.reset();
+	Report(engine, "destroy", n, n, destroyTimer.Seconds());
+
+	cout << left << setw(14) << engine << setw(20) << "peak RSS" << right << setw(11) << n
+		 << setw(12) << PeakRssKb() / 1024 << " MB" << endl << endl;
+}
+
+// Threads insert interleaved slices of the same shuffled keys, so every
+// thread hits every shard. InsertBatch starts its own threads, one per core.
+static void RunShardedScaling(const char *engine, size_t n){
+	vector<int> keys(n);
+	for (size_t i = 0; i < n; i++) keys[i] = 2 * i;
+	mt19937 gen(42);
+	shuffle(keys.begin(), keys.end(), gen);
+
+	unsigned int cores = max(1u, thread::hardware_concurrency());
+	for (unsigned int threads = 1; ; threads = min(threads * 2, cores)) {
+		ShardedRedBlackTree tree;
+		Timer timer;
+		vector<thread> workers;
+		for (unsigned int t = 0; t < threads; t++) {
+			workers.push_back(thread([&, t]() {
+				for (size_t i = t; i < n; i += threads) tree.TryInsert(keys[i]);
+			}));
+		}
+		for (thread &worker : workers) worker.join();
+		double seconds = timer.Seconds();
+		sink = tree.Size();
+		string operation = "insert x" + to_string(threads) + (threads == 1 ? " thread" : " threads");
+		Report(engine, operation.c_str(), n, n, seconds);
+		if (threads == cores) break;
+	}
+
+	ShardedRedBlackTree tree;
+	Timer batchTimer;
+	sink = tree.InsertBatch(keys);
+	Report(engine, "InsertBatch", n, n, batchTimer.Seconds());
+	cout << endl;
+}
+
+// Runs a suite in a child so each run starts from a fresh heap and RSS
+static void RunIsolated(const char *engine, size_t n, void (*suite)(const char *, size_t)){
+	cout.flush();
+	pid_t child = fork();
+	if (child == 0) {
+		suite(engine, n);
+		cout.flush();
+		_exit(0);
+	}
+	int status = 0;
+	waitpid(child, &status, 0);
+	if (child < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		cout << engine << " failed at n = " << n << endl;
+	}
+}
+
+int main(int argc, char **argv){
+	vector<size_t> sizes = {1000, 10000, 100000, 1000000};
+	if (argc > 1) {
+		sizes.clear();
+		for (int i = 1; i < argc; i++) sizes.push_back(strtoull(argv[i], nullptr, 10));
+	}
+
+	for (size_t n : sizes) {
+		if (n == 0 || n > size_t(INT_MAX) / 2) {
+			cout << "Skipping size " << n << " (needs between 1 and INT_MAX / 2 keys)" << endl;
+			continue;
+		}
+		RunIsolated(INT_SET_NAME, n, RunSuite<IntSet>);
+		RunIsolated("std::set", n, RunSuite<StdSet>);
+		RunIsolated("Sharded", n, RunShardedScaling);
+	}
+	return 0;
+}
@@ -3,10 +3,43 @@
 #include <cassert>
 #include <random>
 #include <climits>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include "RedBlackTree.h"
+#include "RedBlackMap.h"
+#include "ConcurrentRedBlackTree.h"
+#include "PersistentRedBlackTree.h"
+#include "FrozenRedBlackTree.h"
+#include "WideNodeTree.h"
+#include "ShardedRedBlackTree.h"
 
 using namespace std;
 
+// Makes the allocation this many calls from now throw bad_alloc (-1 = never),
+// so tests can check what a failed insert leaves behind
+static int allocationsUntilFailure = -1;
+
+void *operator new(size_t size){
+	if (allocationsUntilFailure == 0){
+		allocationsUntilFailure = -1;
+		throw bad_alloc();
+	}
+	if (allocationsUntilFailure > 0) allocationsUntilFailure--;
+	void *memory = malloc(size == 0 ? 1 : size);
+	if (memory == nullptr) throw bad_alloc();
+	return memory;
+}
+
+void operator delete(void *memory) noexcept { free(memory); }
+void operator delete(void *memory, size_t) noexcept { free(memory); }
+
 void TestSimpleConstructor(){
 	cout << "Testing Simple Constructor... " << endl;
 	RedBlackTree rbt = RedBlackTree();
@@ -465,6 +498,20 @@ void TestAscendingInsert(){
 		rbt.Insert(i);
 	}
 	assert(rbt.Size() == 10);
+
+	// Every key is a new max, so each one takes the append fast path
+	// (make bench times this at real sizes)
+	RedBlackTree big;
+	for (int i = 0; i < 100000; ++i){
+		big.Insert(i);
+	}
+	assert(big.Size() == 100000);
+	assert(big.GetMax() == 99999);
+	assert(big.Validate().valid);
+	if (RedBlackTree::STATS_ENABLED){
+		// Each search only looked at the old max
+		assert(big.Stats().depthHistogram[1] == 100000 - 1);
+	}
 	cout << "PASSED!" << endl << endl;
 }
 
@@ -475,6 +522,86 @@ void TestDescendingInsert(){
 		rbt.Insert(i);
 	}
 	assert(rbt.Size() == 10);
+
+	RedBlackTree big;
+	for (int i = 100000; i > 0; --i){
+		big.Insert(i);
+	}
+	assert(big.Size() == 100000);
+	assert(big.GetMin() == 1);
+	assert(big.Validate().valid);
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestHintedInsert(){
+	cout << "Testing Hinted Insert..." << endl;
+	RedBlackTree rbt;
+	// end() means "near the max", like sequence numbers arriving in order
+	RedBlackTree::Iterator hint = rbt.end();
+	for (int i = 0; i < 1000; i += 2){
+		hint = rbt.Insert(hint, i);
+		assert(*hint == i);
+	}
+	// Fill the gaps going down, each one right next to the last
+	hint = rbt.end();
+	for (int i = 999; i > 0; i -= 2){
+		hint = rbt.Insert(hint, i);
+	}
+	assert(rbt.Size() == 1000);
+	assert(rbt.Validate().valid);
+	assert(vector<int>(rbt.begin(), rbt.end()).front() == 0);
+
+	// A bad hint is just slower, never wrong
+	hint = rbt.Insert(rbt.find(0), 5000);
+	hint = rbt.Insert(rbt.find(999), -5000);
+	assert(*hint == -5000);
+	assert(rbt.GetMin() == -5000 && rbt.GetMax() == 5000);
+	assert(rbt.Select(1) == 0);
+	assert(rbt.Validate().valid);
+
+	try{
+		rbt.Insert(rbt.find(500), 501);
+		assert(false);
+	}
+	catch(invalid_argument &e){
+	}
+	assert(rbt.Size() == 1002);
+	assert(rbt.Validate().valid);
+
+	// Keys just below the min take the prepend fast path
+	RedBlackTree mixed;
+	for (int i = 0; i < 1000; i++){
+		mixed.Insert(i % 2 == 0 ? i : -i);
+	}
+	assert(mixed.Validate().valid);
+	assert(mixed.GetMin() == -999 && mixed.GetMax() == 998);
+
+	// A good hint makes the search O(1) amortized: appends look at one node,
+	// and filling gaps in order looks at about three, where a search from the
+	// root of these trees looks at about 17
+	if (RedBlackTree::STATS_ENABLED){
+		auto averageDepth = [](const RedBlackTreeStats &stats){
+			unsigned long long nodes = 0;
+			for (int i = 0; i < RedBlackTreeStats::DEPTH_BUCKETS; i++){
+				nodes += i * stats.depthHistogram[i];
+			}
+			return double(nodes) / stats.searches;
+		};
+		RedBlackTree appended;
+		RedBlackTree::Iterator last = appended.end();
+		for (int i = 0; i < 100000; i++){
+			last = appended.Insert(i % 2 == 0 ? appended.end() : last, 2 * i);
+		}
+		assert(averageDepth(appended.Stats()) <= 1.0);
+
+		RedBlackTree gaps(appended);
+		last = gaps.begin();
+		for (int i = 0; i < 100000; i++){
+			last = gaps.Insert(last, 2 * i + 1);
+		}
+		assert(averageDepth(gaps.Stats()) < 4.0);
+		assert(gaps.Validate().valid);
+	}
 	cout << "PASSED!" << endl << endl;
 }
 
@@ -514,6 +641,1372 @@ void TestInsertDuplicate() {
     }
 }
 
+void TestTryInsert(){
+	cout << "Testing TryInsert..." << endl;
+	RedBlackTree rbt;
+	assert(rbt.TryInsert(30));
+	assert(rbt.TryInsert(15));
+	assert(rbt.TryInsert(45));
+	assert(rbt.TryInsert(15) == false); // duplicate, no exception
+	assert(rbt.TryInsert(30) == false);
+	assert(rbt.Size() == 3);
+	assert(rbt.ToPrefixString() == " B30  R15  R45 ");
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestNodePool(){
+	cout << "Testing Node Pool..." << endl;
+	NodePool pool;
+	RBTNode *a = pool.Allocate();
+	RBTNode *b = pool.Allocate();
+	assert(a != b);
+	pool.Free(a);
+	assert(pool.Allocate() == a); // freed nodes get reused first
+
+	RBTNode *block = pool.AllocateBlock(1000);
+	assert(block != nullptr);
+	assert(pool.Capacity() >= 1002);
+	pool.Release();
+	assert(pool.Capacity() == 0);
+
+	// A big tree only needs a handful of slabs
+	RedBlackTree rbt;
+	for (int i = 0; i < 10000; i++){
+		rbt.Insert(i);
+	}
+	assert(rbt.Size() == 10000);
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestNodeLayout(){
+	cout << "Testing Node Layout..." << endl;
+#ifdef RBT_COMPACT_NODES
+	assert(sizeof(RBTNode) <= 32);
+#endif
+	RBTNode node;
+	RBTNode other;
+	node.SetColor(COLOR_RED);
+	node.SetParent(&other);
+	assert(node.GetParent() == &other);
+	assert(node.GetColor() == COLOR_RED);
+	node.SetColor(COLOR_BLACK);
+	assert(node.GetParent() == &other); // changing the color keeps the parent
+	assert(node.GetColor() == COLOR_BLACK);
+	node.SetParent(nullptr);
+	assert(node.GetColor() == COLOR_BLACK); // and the other way around
+
+	RedBlackTree rbt;
+	rbt.Insert(12);
+	rbt.Insert(11);
+	rbt.Insert(15);
+	rbt.Insert(5);
+	rbt.Insert(13);
+	rbt.Insert(7);
+	assert(rbt.ToPrefixString() == " B12  B7  R5  R11  B15  R13 ");
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestRemove(){
+	cout << "Testing Remove..." << endl;
+	RedBlackTree rbt;
+	assert(rbt.Remove(10) == false); // empty tree
+
+	int nodes[] = {30, 15, 45, 10, 25, 40, 50, 5};
+	for (int x : nodes){
+		rbt.Insert(x);
+	}
+	assert(rbt.ToPrefixString() == " B30  R15  B10  R5  B25  B45  R40  R50 ");
+
+	assert(rbt.Remove(99) == false);
+	assert(rbt.Remove(5)); // red leaf, nothing to fix
+	assert(rbt.ToPrefixString() == " B30  R15  B10  B25  B45  R40  R50 ");
+	assert(rbt.Remove(30)); // root with two children, successor takes its place
+	assert(rbt.ToPrefixString() == " B40  R15  B10  B25  B45  R50 ");
+	assert(rbt.Remove(10)); // black leaf, red sibling's parent absorbs the double black
+	assert(rbt.ToPrefixString() == " B40  B15  R25  B45  R50 ");
+	assert(rbt.Remove(15)); // one red child gets painted black
+	assert(rbt.ToPrefixString() == " B40  B25  B45  R50 ");
+	assert(rbt.Remove(25)); // black leaf with a far red nephew -> rotation
+	assert(rbt.ToPrefixString() == " B45  B40  B50 ");
+	assert(rbt.Size() == 3);
+	assert(rbt.Contains(25) == false);
+
+	assert(rbt.Remove(40));
+	assert(rbt.Remove(45));
+	assert(rbt.Remove(50));
+	assert(rbt.Size() == 0);
+	assert(rbt.ToPrefixString() == "");
+	rbt.Insert(7); // tree is usable again after being emptied
+	assert(rbt.ToPrefixString() == " B7 ");
+
+	// Lots of random inserts and removes, checked against a plain bool array
+	RedBlackTree big;
+	bool present[2000] = {false};
+	size_t count = 0;
+	mt19937 gen(42);
+	uniform_int_distribution<int> dist(0, 1999);
+	for (int i = 0; i < 20000; i++){
+		int x = dist(gen);
+		if (gen() % 2 == 0){
+			assert(big.TryInsert(x) == !present[x]);
+			if (!present[x]) count++;
+			present[x] = true;
+		} else {
+			assert(big.Remove(x) == present[x]);
+			if (present[x]) count--;
+			present[x] = false;
+		}
+	}
+	assert(big.Size() == count);
+	for (int x = 0; x < 2000; x++){
+		assert(big.Contains(x) == present[x]);
+	}
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestWriteStreams(){
+	cout << "Testing Streaming Traversals..." << endl;
+	RedBlackTree rbt;
+	ostringstream empty;
+	rbt.WriteInfix(empty);
+	assert(empty.str() == "");
+
+	rbt.Insert(12);
+	rbt.Insert(11);
+	rbt.Insert(15);
+	rbt.Insert(5);
+	rbt.Insert(13);
+	rbt.Insert(7);
+	ostringstream prefix, infix, postfix;
+	rbt.WritePrefix(prefix);
+	rbt.WriteInfix(infix);
+	rbt.WritePostfix(postfix);
+	assert(prefix.str() == " B12  B7  R5  R11  B15  R13 ");
+	assert(infix.str() == " R5  B7  R11  B12  R13  B15 ");
+	assert(postfix.str() == " R5  R11  B7  R13  B15  B12 ");
+
+	// Big enough to go through the write buffer several times
+	RedBlackTree big;
+	for (int i = -3000; i < 3000; i++){
+		big.Insert(i);
+	}
+	ostringstream bigInfix;
+	big.WriteInfix(bigInfix);
+	assert(bigInfix.str() == big.ToInfixString());
+	assert(big.ToInfixString().substr(0, 15) == " B-3000  B-2999");
+	ostringstream bigPrefix, bigPostfix;
+	big.WritePrefix(bigPrefix);
+	big.WritePostfix(bigPostfix);
+	assert(bigPrefix.str() == big.ToPrefixString());
+	assert(bigPostfix.str() == big.ToPostfixString());
+	assert(bigPrefix.str().size() == bigPostfix.str().size());
+
+	RedBlackTree extremes;
+	extremes.Insert(INT_MIN);
+	extremes.Insert(INT_MAX);
+	assert(extremes.ToInfixString() == " B-2147483648  R2147483647 ");
+	cout << "PASSED!" << endl << endl;
+}
+
+// Map value that counts live copies, throws when built from a negative id,
+// and throws on a copy once copiesLeft runs out
+struct Fragile {
+	static int live;
+	static int copiesLeft;
+	int id;
+
+	Fragile(int id) : id(id) {
+		if (id < 0) throw runtime_error("bad id");
+		live++;
+	}
+	Fragile(const Fragile &other) : id(other.id) {
+		if (copiesLeft == 0) throw runtime_error("out of copies");
+		if (copiesLeft > 0) copiesLeft--;
+		live++;
+	}
+	~Fragile() { live--; }
+};
+int Fragile::live = 0;
+int Fragile::copiesLeft = -1;
+
+void TestRedBlackMap(){
+	cout << "Testing Red Black Map..." << endl;
+	RedBlackMap<string, string> names;
+	assert(names.Emplace("b", "bee"));
+	assert(names.Emplace("a", 3, 'a')); // string(3, 'a') built in place
+	assert(names.Emplace("a", "again") == false);
+	names.Insert("c", "sea");
+	bool caught = false;
+	try {
+		names.Insert("c", "again");
+	} catch (const std::invalid_argument& e) {
+		caught = true;
+	}
+	assert(caught);
+	assert(names.Size() == 3);
+	assert(names.At("a") == "aaa");
+	assert(*names.Find("b") == "bee");
+	assert(names.Find("z") == nullptr);
+	names["d"] = "dee";
+	assert(names.Contains("d"));
+	assert(names.GetMinKey() == "a");
+	assert(names.GetMaxKey() == "d");
+
+	string order;
+	names.ForEach([&](const string &key, const string &value){ order += key + "=" + value + " "; });
+	assert(order == "a=aaa b=bee c=sea d=dee ");
+
+	RedBlackMap<string, string> copy(names);
+	assert(names.Remove("b"));
+	assert(names.Remove("b") == false);
+	assert(copy.At("b") == "bee"); // the copy keeps its own nodes
+	RedBlackMap<string, string> moved(std::move(copy));
+	assert(moved.Size() == 4);
+	assert(copy.Size() == 0);
+
+	// Values that can only be moved
+	RedBlackMap<int, unique_ptr<int>> owners;
+	owners.Emplace(1, new int(10));
+	owners.Insert(2, unique_ptr<int>(new int(20)));
+	assert(*owners.At(2) == 20);
+
+	// Custom ordering, checked against random inserts and removes
+	RedBlackMap<int, int, greater<int>> reversed;
+	bool present[500] = {false};
+	mt19937 gen(7);
+	for (int i = 0; i < 5000; i++){
+		int x = gen() % 500;
+		if (gen() % 3 != 0){
+			assert(reversed.Emplace(x, x * 2) == !present[x]);
+			present[x] = true;
+		} else {
+			assert(reversed.Remove(x) == present[x]);
+			present[x] = false;
+		}
+	}
+	int last = INT_MAX;
+	size_t count = 0;
+	reversed.ForEach([&](int key, int value){
+		assert(key < last);
+		assert(value == key * 2);
+		assert(present[key]);
+		last = key;
+		count++;
+	});
+	assert(count == reversed.Size());
+
+	// A value whose constructor throws leaves the map as it was
+	RedBlackMap<int, Fragile> fragile;
+	fragile.Emplace(1, 1);
+	fragile.Emplace(2, 2);
+	try{
+		fragile.Emplace(3, -1);
+		assert(false);
+	}
+	catch(runtime_error &e){
+	}
+	assert(fragile.Size() == 2 && !fragile.Contains(3));
+	assert(Fragile::live == 2);
+
+	// A copy that throws halfway destroys what it already copied
+	for (int i = 3; i <= 100; i++){
+		fragile.Emplace(i, i);
+	}
+	Fragile::copiesLeft = 40;
+	try{
+		RedBlackMap<int, Fragile> copied(fragile);
+		assert(false);
+	}
+	catch(runtime_error &e){
+	}
+	Fragile::copiesLeft = -1;
+	assert(Fragile::live == 100);
+	RedBlackMap<int, Fragile> copied(fragile);
+	assert(copied.Size() == 100 && copied.At(50).id == 50);
+	assert(Fragile::live == 200);
+	copied.Clear();
+	fragile.Clear();
+	assert(Fragile::live == 0);
+
+	// Rvalue keys are moved in, not copied
+	RedBlackMap<string, int> moves;
+	string longKey(100, 'k');
+	const char *buffer = longKey.data();
+	moves.Emplace(std::move(longKey), 1);
+	string otherKey(100, 'o');
+	moves[std::move(otherKey)] = 2;
+	bool stolen = false;
+	moves.ForEach([&](const string &key, int value){
+		if (value == 1) stolen = key.data() == buffer;
+	});
+	assert(stolen);
+	assert(moves.At(string(100, 'o')) == 2);
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestIterators(){
+	cout << "Testing Iterators and Range Scans..." << endl;
+	RedBlackTree empty;
+	assert(empty.begin() == empty.end());
+	assert(empty.lower_bound(5) == empty.end());
+
+	RedBlackTree rbt;
+	for (int x : {40, 10, 30, 20, 50, 70, 60}){
+		rbt.Insert(x);
+	}
+	vector<int> keys(rbt.begin(), rbt.end());
+	assert(keys == vector<int>({10, 20, 30, 40, 50, 60, 70}));
+	assert(distance(rbt.begin(), rbt.end()) == 7);
+
+	// Walking backwards from end()
+	vector<int> backwards;
+	RedBlackTree::Iterator it = rbt.end();
+	while (it != rbt.begin()){
+		--it;
+		backwards.push_back(*it);
+	}
+	assert(backwards == vector<int>({70, 60, 50, 40, 30, 20, 10}));
+
+	assert(*rbt.lower_bound(30) == 30);
+	assert(*rbt.lower_bound(31) == 40);
+	assert(*rbt.lower_bound(-5) == 10);
+	assert(rbt.lower_bound(71) == rbt.end());
+	assert(*rbt.upper_bound(30) == 40);
+	assert(*rbt.upper_bound(9) == 10);
+	assert(rbt.upper_bound(70) == rbt.end());
+	assert(*rbt.find(50) == 50);
+	assert(rbt.find(55) == rbt.end());
+
+	pair<RedBlackTree::Iterator, RedBlackTree::Iterator> range = rbt.equal_range(20);
+	assert(distance(range.first, range.second) == 1 && *range.first == 20);
+	range = rbt.equal_range(25);
+	assert(range.first == range.second && *range.first == 30);
+
+	// All keys in [25, 60)
+	vector<int> scan;
+	for (RedBlackTree::Iterator i = rbt.lower_bound(25); i != rbt.lower_bound(60); ++i){
+		scan.push_back(*i);
+	}
+	assert(scan == vector<int>({30, 40, 50}));
+
+	int sum = 0;
+	for (int x : rbt){
+		sum += x;
+	}
+	assert(sum == 280);
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestPopMinMax(){
+	cout << "Testing PopMin and PopMax..." << endl;
+	RedBlackTree rbt;
+	bool caught = false;
+	try {
+		rbt.PopMin();
+	} catch (const std::runtime_error& e) {
+		caught = true;
+		assert(string(e.what()) == "Red Black Tree is empty");
+	}
+	assert(caught);
+
+	for (int x : {50, 20, 80, 10, 30, 70, 90, 60}){
+		rbt.Insert(x);
+	}
+	assert(rbt.PopMin() == 10);
+	assert(rbt.GetMin() == 20);
+	assert(rbt.PopMax() == 90);
+	assert(rbt.GetMax() == 80);
+	rbt.Insert(5); // new min and max go straight into the cache
+	rbt.Insert(95);
+	assert(rbt.GetMin() == 5);
+	assert(rbt.GetMax() == 95);
+	rbt.Remove(95);
+	assert(rbt.GetMax() == 80);
+
+	RedBlackTree copy(rbt);
+	assert(copy.GetMin() == 5);
+	assert(copy.GetMax() == 80);
+
+	// Draining in order works like a priority queue
+	vector<int> drained;
+	while (rbt.Size() > 0){
+		drained.push_back(rbt.PopMin());
+	}
+	assert(drained == vector<int>({5, 20, 30, 50, 60, 70, 80}));
+	assert(rbt.begin() == rbt.end());
+
+	RedBlackTree deadlines;
+	mt19937 gen(3);
+	for (int i = 0; i < 1000; i++){
+		deadlines.TryInsert(gen() % 100000);
+	}
+	int previous = INT_MAX;
+	while (deadlines.Size() > 0){
+		int top = deadlines.PopMax();
+		assert(top < previous);
+		previous = top;
+	}
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestOrderStatistics(){
+	cout << "Testing Select, Rank and CountInRange..." << endl;
+	RedBlackTree rbt;
+	assert(rbt.Rank(10) == 0);
+	assert(rbt.CountInRange(0, 100) == 0);
+	bool caught = false;
+	try {
+		rbt.Select(0);
+	} catch (const std::out_of_range& e) {
+		caught = true;
+	}
+	assert(caught);
+
+	for (int x : {40, 10, 30, 20, 50, 70, 60}){
+		rbt.Insert(x);
+	}
+	assert(rbt.Select(0) == 10);
+	assert(rbt.Select(3) == 40);
+	assert(rbt.Select(6) == 70);
+	assert(rbt.Rank(10) == 0);
+	assert(rbt.Rank(35) == 3);
+	assert(rbt.Rank(40) == 3);
+	assert(rbt.Rank(1000) == 7);
+	assert(rbt.CountInRange(20, 60) == 4);
+	assert(rbt.CountInRange(21, 60) == 3);
+	assert(rbt.CountInRange(60, 20) == 0);
+	assert(rbt.TryInsert(30) == false); // a failed insert leaves the counts alone
+	assert(rbt.Rank(1000) == 7);
+
+	// Random inserts and removes, compared against a sorted vector
+	RedBlackTree big;
+	vector<int> sorted;
+	mt19937 gen(11);
+	for (int i = 0; i < 6000; i++){
+		int x = gen() % 3000;
+		vector<int>::iterator spot = std::lower_bound(sorted.begin(), sorted.end(), x);
+		bool there = spot != sorted.end() && *spot == x;
+		if (gen() % 3 != 0){
+			assert(big.TryInsert(x) == !there);
+			if (!there) sorted.insert(spot, x);
+		} else {
+			assert(big.Remove(x) == there);
+			if (there) sorted.erase(spot);
+		}
+	}
+	RedBlackTree copy(big);
+	for (size_t k = 0; k < sorted.size(); k++){
+		assert(big.Select(k) == sorted[k]);
+		assert(copy.Select(k) == sorted[k]);
+	}
+	for (int x = -1; x <= 3001; x += 7){
+		size_t expected = std::lower_bound(sorted.begin(), sorted.end(), x) - sorted.begin();
+		assert(big.Rank(x) == expected);
+	}
+	assert(big.CountInRange(0, 3000) == sorted.size());
+
+	// An insert that runs out of memory leaves the counts alone too. The
+	// first slab is full, so the next node needs a new one.
+	RedBlackTree full;
+	for (int i = 0; i < 64; i++){
+		full.Insert(2 * i);
+	}
+	for (int attempt = 0; attempt < 2; attempt++){
+		allocationsUntilFailure = 0;
+		caught = false;
+		try {
+			if (attempt == 0){
+				full.TryInsert(1000);
+			} else {
+				full.Insert(full.find(60), 61); // the hinted walk starts partway down
+			}
+		} catch (const bad_alloc &e) {
+			caught = true;
+		}
+		allocationsUntilFailure = -1;
+		assert(caught);
+		assert(full.Size() == 64);
+		assert(full.Validate().valid);
+		assert(full.Rank(1000) == 64);
+		assert(full.Select(63) == 126);
+	}
+	assert(full.TryInsert(61));
+	assert(full.Rank(62) == 32 && full.Validate().valid);
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestBuildFromSorted(){
+	cout << "Testing Build From Sorted..." << endl;
+	vector<int> none;
+	RedBlackTree empty = RedBlackTree::BuildFromSorted(none.begin(), none.end());
+	assert(empty.Size() == 0);
+	assert(empty.ToPrefixString() == "");
+
+	int one[] = {5};
+	RedBlackTree single = RedBlackTree::BuildFromSorted(one, one + 1);
+	assert(single.ToPrefixString() == " B5 ");
+
+	vector<int> seven = {1, 2, 3, 4, 5, 6, 7};
+	RedBlackTree full = RedBlackTree::BuildFromSorted(seven.begin(), seven.end());
+	assert(full.ToPrefixString() == " B4  B2  R1  R3  B6  R5  R7 ");
+
+	vector<int> ten = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+	RedBlackTree partial = RedBlackTree::BuildFromSorted(ten.begin(), ten.end());
+	assert(partial.ToPrefixString() == " B6  B3  B2  R1  B5  R4  B9  B8  R7  B10 ");
+	assert(partial.Size() == 10);
+	assert(partial.GetMin() == 1);
+	assert(partial.GetMax() == 10);
+	assert(partial.Select(4) == 5);
+
+	// The built tree works like any other tree afterwards
+	partial.Insert(11);
+	partial.Remove(6);
+	assert(vector<int>(partial.begin(), partial.end()) == vector<int>({1, 2, 3, 4, 5, 7, 8, 9, 10, 11}));
+
+	vector<int> big;
+	for (int i = 0; i < 100000; i++){
+		big.push_back(i * 3);
+	}
+	RedBlackTree bigTree = RedBlackTree::BuildFromSorted(big.begin(), big.end());
+	assert(bigTree.Size() == big.size());
+	assert(vector<int>(bigTree.begin(), bigTree.end()) == big);
+	assert(bigTree.Rank(300) == 100);
+	for (int i = 0; i < 1000; i++){
+		assert(bigTree.Remove(i * 3));
+	}
+	assert(bigTree.GetMin() == 3000);
+
+	vector<int> unsorted = {1, 3, 2};
+	bool caught = false;
+	try {
+		RedBlackTree::BuildFromSorted(unsorted.begin(), unsorted.end());
+	} catch (const std::invalid_argument& e) {
+		caught = true;
+	}
+	assert(caught);
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestCopyAndMove(){
+	cout << "Testing Copy Size, Move and Clear..." << endl;
+	RedBlackTree rbt1;
+	for (int x : {11, 23, 9, 52, 31, 4}){
+		rbt1.Insert(x);
+	}
+	RedBlackTree rbt2(rbt1);
+	assert(rbt2.Size() == 6); // the copy used to report 0
+	assert(rbt2.ToPrefixString() == " B11  B9  R4  B31  R23  R52 ");
+	assert(rbt2.GetMin() == 4 && rbt2.GetMax() == 52);
+	assert(rbt2.Select(2) == 11);
+
+	RedBlackTree empty;
+	RedBlackTree emptyCopy(empty);
+	assert(emptyCopy.Size() == 0);
+	assert(emptyCopy.begin() == emptyCopy.end());
+
+	// Copy assignment replaces what was there
+	RedBlackTree rbt3;
+	rbt3.Insert(1000);
+	rbt3 = rbt1;
+	assert(rbt3.ToPrefixString() == rbt1.ToPrefixString());
+	assert(rbt3.Size() == 6);
+	rbt3 = rbt3;
+	assert(rbt3.Size() == 6);
+
+	// Moves leave the source empty but usable
+	RedBlackTree moved(std::move(rbt2));
+	assert(moved.Size() == 6);
+	assert(rbt2.Size() == 0);
+	assert(rbt2.ToPrefixString() == "");
+	rbt2.Insert(3);
+	assert(rbt2.ToPrefixString() == " B3 ");
+	rbt2 = std::move(moved);
+	assert(rbt2.ToPrefixString() == " B11  B9  R4  B31  R23  R52 ");
+
+	// A copy of a big tree has the same shape and works on its own
+	RedBlackTree big;
+	for (int i = 0; i < 50000; i++){
+		big.Insert((i * 7919) % 50000);
+	}
+	RedBlackTree bigCopy(big);
+	assert(bigCopy.ToPrefixString() == big.ToPrefixString());
+	bigCopy.Remove(0);
+	bigCopy.Insert(-1);
+	assert(big.Contains(0) && !big.Contains(-1));
+	assert(bigCopy.Size() == big.Size());
+
+	big.Clear();
+	assert(big.Size() == 0);
+	assert(big.ToInfixString() == "");
+	big.Insert(5);
+	big.Insert(6);
+	assert(big.ToPrefixString() == " B5  R6 ");
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestBatchLookups(){
+	cout << "Testing Batch Lookups..." << endl;
+	RedBlackTree empty;
+	vector<int> someKeys = {1, 2, 3};
+	bool emptyFound[3] = {true, true, true};
+	empty.ContainsBatch(someKeys, emptyFound);
+	assert(!emptyFound[0] && !emptyFound[1] && !emptyFound[2]);
+
+	RedBlackTree rbt;
+	for (int i = 0; i < 5000; i++){
+		rbt.Insert(i * 2); // only even keys
+	}
+
+	// Sorted batch, with repeats and keys off both ends
+	vector<int> sorted;
+	for (int i = -10; i < 10020; i += 3){
+		sorted.push_back(i);
+		if (i % 9 == 0) sorted.push_back(i);
+	}
+	bool *foundFlags = new bool[sorted.size()];
+	rbt.ContainsBatch(sorted, span<bool>(foundFlags, sorted.size()));
+	for (size_t i = 0; i < sorted.size(); i++){
+		assert(foundFlags[i] == rbt.Contains(sorted[i]));
+	}
+	delete[] foundFlags;
+
+	// Random batch goes through the interleaved searches
+	vector<int> shuffled;
+	mt19937 gen(5);
+	for (int i = 0; i < 3000; i++){
+		shuffled.push_back(int(gen() % 12000) - 1000);
+	}
+	vector<RedBlackTree::Iterator> iterators(shuffled.size());
+	rbt.FindBatch(shuffled, iterators);
+	for (size_t i = 0; i < shuffled.size(); i++){
+		assert(iterators[i] == rbt.find(shuffled[i]));
+		if (iterators[i] != rbt.end()){
+			assert(*iterators[i] == shuffled[i]);
+		}
+	}
+
+	bool tooSmall[1];
+	bool caught = false;
+	try {
+		rbt.ContainsBatch(someKeys, tooSmall);
+	} catch (const std::invalid_argument& e) {
+		caught = true;
+	}
+	assert(caught);
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestInsertRange(){
+	cout << "Testing Insert Range..." << endl;
+	RedBlackTree rbt;
+	vector<int> first = {10, 20, 30, 40, 50};
+	assert(rbt.InsertRange(first.begin(), first.end()) == 5);
+	assert(rbt.ToPrefixString() == " B20  B10  B40  R30  R50 "); // same as inserting one by one
+
+	// Merge a sorted batch that overlaps the tree, reporting duplicates
+	vector<int> batch;
+	for (int i = 0; i <= 60; i += 5){
+		batch.push_back(i);
+	}
+	vector<int> duplicates;
+	assert(rbt.InsertRange(batch.begin(), batch.end(), &duplicates) == 8);
+	assert(duplicates == vector<int>({10, 20, 30, 40, 50}));
+	assert(rbt.Size() == 13);
+	assert(vector<int>(rbt.begin(), rbt.end()) == batch);
+	assert(rbt.Select(12) == 60);
+	assert(rbt.Rank(33) == 7);
+
+	// Skipping duplicates without collecting them
+	assert(rbt.InsertRange(batch.begin(), batch.end()) == 0);
+
+	// Unsorted batches still work, they just search from the root
+	int mixed[] = {3, 1, 2, 100, 99, 1};
+	assert(rbt.InsertRange(mixed, mixed + 6) == 5);
+	assert(rbt.Size() == 18);
+
+	// Input iterators can only be walked once, so the batch isn't counted up front
+	istringstream in("200 201 202 60 203");
+	assert(rbt.InsertRange(istream_iterator<int>(in), istream_iterator<int>()) == 4);
+	assert(rbt.Size() == 22);
+	assert(rbt.GetMax() == 203);
+	assert(rbt.Validate().valid);
+
+	// Many sorted micro-batches into one tree, checked against a copy built one key at a time
+	RedBlackTree batched;
+	RedBlackTree single;
+	mt19937 gen(17);
+	for (int round = 0; round < 50; round++){
+		vector<int> keys;
+		for (int i = 0; i < 200; i++){
+			keys.push_back(gen() % 20000);
+		}
+		sort(keys.begin(), keys.end());
+		batched.InsertRange(keys.begin(), keys.end());
+		for (int key : keys){
+			single.TryInsert(key);
+		}
+	}
+	assert(batched.Size() == single.Size());
+	assert(batched.ToPrefixString() == single.ToPrefixString());
+	for (size_t k = 0; k < batched.Size(); k += 97){
+		assert(batched.Select(k) == single.Select(k));
+	}
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestSplitJoin(){
+	cout << "Testing Split and Join..." << endl;
+	RedBlackTree left;
+	RedBlackTree right;
+	for (int x : {1, 2, 3}){
+		left.Insert(x);
+	}
+	for (int x : {10, 20, 30, 40, 50, 60, 70}){
+		right.Insert(x);
+	}
+	RedBlackTree joined = RedBlackTree::Join(std::move(left), 5, std::move(right));
+	assert(joined.Size() == 11);
+	assert(left.Size() == 0 && right.Size() == 0);
+	assert(joined.ToPrefixString() == " B20  R5  B2  R1  R3  B10  R40  B30  B60  R50  R70 ");
+	assert(joined.GetMin() == 1 && joined.GetMax() == 70);
+	assert(joined.Select(3) == 5);
+
+	// The pivot has to sit between the two trees
+	RedBlackTree low(10);
+	RedBlackTree high(20);
+	bool caught = false;
+	try {
+		RedBlackTree::Join(std::move(low), 25, std::move(high));
+	} catch (const std::invalid_argument& e) {
+		caught = true;
+	}
+	assert(caught);
+	assert(low.Size() == 1 && high.Size() == 1); // nothing was taken
+
+	// Joining with empty trees
+	RedBlackTree empty1, empty2;
+	RedBlackTree justPivot = RedBlackTree::Join(std::move(empty1), 7, std::move(empty2));
+	assert(justPivot.ToPrefixString() == " B7 ");
+
+	pair<RedBlackTree, RedBlackTree> halves = joined.Split(30);
+	assert(joined.Size() == 0);
+	assert(vector<int>(halves.first.begin(), halves.first.end()) == vector<int>({1, 2, 3, 5, 10, 20}));
+	assert(vector<int>(halves.second.begin(), halves.second.end()) == vector<int>({40, 50, 60, 70}));
+	assert(halves.first.GetMax() == 20 && halves.second.GetMin() == 40);
+
+	// Both halves keep working, even after the other one is gone
+	{
+		pair<RedBlackTree, RedBlackTree> quarters = halves.first.Split(4);
+		assert(quarters.first.Size() == 3);
+		assert(quarters.second.Size() == 3);
+		quarters.second.Insert(4);
+		assert(quarters.second.GetMin() == 4);
+	}
+	halves.second.Insert(80);
+	halves.second.Remove(40);
+	assert(vector<int>(halves.second.begin(), halves.second.end()) == vector<int>({50, 60, 70, 80}));
+
+	// Move a key range between big trees and back again
+	RedBlackTree big;
+	for (int i = 0; i < 20000; i++){
+		big.Insert(i);
+	}
+	pair<RedBlackTree, RedBlackTree> parts = big.Split(12345);
+	assert(parts.first.Size() == 12345);
+	assert(parts.second.Size() == 20000 - 12346);
+	assert(parts.first.Rank(12345) == 12345);
+	RedBlackTree whole = RedBlackTree::Join(std::move(parts.first), 12345, std::move(parts.second));
+	assert(whole.Size() == 20000);
+	for (int i = 0; i < 20000; i += 101){
+		assert(whole.Select(i) == i);
+	}
+
+	// A Join that runs out of memory leaves both trees alone. The left tree's
+	// first slab is full, so the pivot needs a new one.
+	for (int failAt = 0; ; failAt++){
+		RedBlackTree low, high;
+		for (int i = 0; i < 64; i++){
+			low.Insert(i);
+			high.Insert(i + 100);
+		}
+		allocationsUntilFailure = failAt;
+		try {
+			RedBlackTree joinedUp = RedBlackTree::Join(std::move(low), 70, std::move(high));
+			allocationsUntilFailure = -1;
+			assert(joinedUp.Size() == 129 && joinedUp.Validate().valid);
+			break;
+		} catch (const bad_alloc &e) {
+			assert(low.Size() == 64 && low.Validate().valid);
+			assert(high.Size() == 64 && high.Validate().valid);
+		}
+	}
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestSplitJoinCycles(){
+	cout << "Testing many Split/Join cycles..." << endl;
+	RedBlackTree rbt;
+	for (int i = 0; i < 1000; i++){
+		rbt.Insert(i);
+	}
+	// Pools from old splits mustn't pile up, or every cycle gets slower
+	mt19937 gen(5);
+	for (int cycle = 0; cycle < 2000; cycle++){
+		int key = gen() % 1000;
+		pair<RedBlackTree, RedBlackTree> halves = rbt.Split(key);
+		if (cycle % 2 == 0){
+			halves.second.Insert(5000 + cycle); // The greater half's own pool gets used too
+			halves.second.Remove(5000 + cycle);
+		}
+		rbt = RedBlackTree::Join(std::move(halves.first), key, std::move(halves.second));
+	}
+	assert(rbt.Size() == 1000 && rbt.Validate().valid);
+	assert(rbt.GetMin() == 0 && rbt.GetMax() == 999);
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestSplitAcrossThreads(){
+	cout << "Testing split halves on two threads..." << endl;
+	RedBlackTree big;
+	for (int i = 0; i < 100000; i++){
+		big.Insert(i);
+	}
+	pair<RedBlackTree, RedBlackTree> halves = big.Split(50000);
+	RedBlackTree low(std::move(halves.first));
+	RedBlackTree high(std::move(halves.second));
+
+	// Each half frees and allocates nodes on its own thread
+	auto churn = [](RedBlackTree &tree, int from, int to){
+		for (int i = from; i < to; i += 2){
+			tree.Remove(i);
+		}
+		for (int i = from; i < to; i += 2){
+			tree.Insert(i + 200000);
+		}
+	};
+	thread lowThread(churn, std::ref(low), 0, 50000);
+	thread highThread(churn, std::ref(high), 50001, 100000);
+	lowThread.join();
+	highThread.join();
+
+	assert(low.Size() == 50000 && low.Validate().valid);
+	assert(high.Size() == 49999 && high.Validate().valid);
+	assert(!low.Contains(0) && low.Contains(1) && low.Contains(200000));
+	assert(!high.Contains(50001) && high.Contains(50002) && high.Contains(250001));
+
+	// Dropping one half leaves the other's nodes alone
+	low = RedBlackTree();
+	assert(high.Validate().valid && high.Size() == 49999);
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestSetOperations(){
+	cout << "Testing Union, Intersection and Difference..." << endl;
+	RedBlackTree a, b;
+	for (int x : {1, 3, 5, 7, 9, 11}){
+		a.Insert(x);
+	}
+	for (int x : {3, 4, 5, 6, 12}){
+		b.Insert(x);
+	}
+	RedBlackTree both = RedBlackTree::Union(RedBlackTree(a), RedBlackTree(b));
+	assert(vector<int>(both.begin(), both.end()) == vector<int>({1, 3, 4, 5, 6, 7, 9, 11, 12}));
+	assert(both.Size() == 9);
+	assert(both.GetMin() == 1 && both.GetMax() == 12);
+
+	RedBlackTree common = RedBlackTree::Intersection(RedBlackTree(a), RedBlackTree(b));
+	assert(vector<int>(common.begin(), common.end()) == vector<int>({3, 5}));
+
+	RedBlackTree onlyA = RedBlackTree::Difference(RedBlackTree(a), RedBlackTree(b));
+	assert(vector<int>(onlyA.begin(), onlyA.end()) == vector<int>({1, 7, 9, 11}));
+
+	// Destructive version: the inputs end up empty
+	RedBlackTree onlyB = RedBlackTree::Difference(std::move(b), std::move(a));
+	assert(vector<int>(onlyB.begin(), onlyB.end()) == vector<int>({4, 6, 12}));
+	assert(a.Size() == 0 && b.Size() == 0);
+
+	RedBlackTree empty;
+	RedBlackTree none = RedBlackTree::Intersection(RedBlackTree(onlyB), std::move(empty));
+	assert(none.Size() == 0);
+
+	// Big enough to be split across threads
+	RedBlackTree evens, threes;
+	vector<int> expectedUnion, expectedCommon, expectedDifference;
+	for (int i = 0; i < 60000; i++){
+		if (i % 2 == 0) evens.Insert(i);
+		if (i % 3 == 0) threes.Insert(i);
+		if (i % 2 == 0 || i % 3 == 0) expectedUnion.push_back(i);
+		if (i % 6 == 0) expectedCommon.push_back(i);
+		if (i % 2 == 0 && i % 3 != 0) expectedDifference.push_back(i);
+	}
+	RedBlackTree bigUnion = RedBlackTree::Union(RedBlackTree(evens), RedBlackTree(threes));
+	assert(vector<int>(bigUnion.begin(), bigUnion.end()) == expectedUnion);
+	RedBlackTree bigCommon = RedBlackTree::Intersection(RedBlackTree(evens), RedBlackTree(threes));
+	assert(vector<int>(bigCommon.begin(), bigCommon.end()) == expectedCommon);
+	RedBlackTree bigDifference = RedBlackTree::Difference(std::move(evens), std::move(threes));
+	assert(vector<int>(bigDifference.begin(), bigDifference.end()) == expectedDifference);
+	assert(bigDifference.Select(100) == expectedDifference[100]);
+
+	// Results are normal trees afterwards
+	bigUnion.Insert(-1);
+	bigUnion.Remove(0);
+	assert(bigUnion.GetMin() == -1);
+	assert(bigUnion.Size() == expectedUnion.size());
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestConcurrentReaders(){
+	cout << "Testing Concurrent Readers..." << endl;
+	ConcurrentRedBlackTree rbt;
+	assert(rbt.Contains(1) == false);
+	assert(rbt.Size() == 0);
+
+	// Multiples of 4 are always there, odd keys never are
+	for (int i = 0; i < 4000; i += 4){
+		rbt.Insert(i);
+	}
+	assert(rbt.TryInsert(0) == false);
+	assert(rbt.Size() == 1000);
+
+	atomic<bool> stop(false);
+	atomic<int> wrongAnswers(0);
+	vector<thread> readers;
+	for (int r = 0; r < 4; r++){
+		readers.push_back(thread([&, r](){
+			int i = r;
+			while (!stop.load()){
+				int key = (i * 37) % 4000;
+				if (key % 4 == 0 && !rbt.Contains(key)) wrongAnswers++;
+				if (key % 2 == 1 && rbt.Contains(key)) wrongAnswers++;
+				if (rbt.GetMin() != 0) wrongAnswers++;
+				i++;
+			}
+		}));
+	}
+
+	// Meanwhile the writer keeps adding and removing the 4k+2 keys
+	for (int round = 0; round < 5; round++){
+		for (int i = 2; i < 4000; i += 4){
+			rbt.Insert(i);
+		}
+		for (int i = 2; i < 4000; i += 4){
+			assert(rbt.Remove(i));
+		}
+	}
+	stop = true;
+	for (thread &reader : readers){
+		reader.join();
+	}
+	assert(wrongAnswers == 0);
+	assert(rbt.Size() == 1000);
+	assert(rbt.GetMax() == 3996);
+
+	// A write that throws still finishes its version bump, otherwise the
+	// next read would spin forever
+	bool caught = false;
+	for (int key = 10000; !caught; key++){
+		allocationsUntilFailure = 0;
+		try {
+			rbt.Insert(key);
+		} catch (const bad_alloc &e) {
+			caught = true;
+			assert(rbt.Contains(key) == false);
+		}
+		allocationsUntilFailure = -1;
+	}
+	assert(rbt.Contains(3996));
+	assert(rbt.TryInsert(3998));
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestPersistentSnapshots(){
+	cout << "Testing Persistent Snapshots..." << endl;
+	PersistentRedBlackTree rbt;
+	rbt.Insert(10);
+	rbt.Insert(20);
+	rbt.Insert(30);
+	assert(rbt.ToPrefixString() == " B20  B10  B30 ");
+	assert(rbt.TryInsert(20) == false);
+	assert(rbt.Size() == 3);
+
+	PersistentRedBlackTree before = rbt.Snapshot();
+	rbt.Insert(15);
+	assert(before.Size() == 3);
+	assert(before.Contains(15) == false);
+	assert(before.ToPrefixString() == " B20  B10  B30 ");
+	assert(rbt.Contains(15));
+
+	// Lots of versions, each one still sees only its own keys
+	vector<PersistentRedBlackTree> versions;
+	PersistentRedBlackTree grow;
+	for (int i = 0; i < 2000; i++){
+		grow.Insert((i * 7919) % 2000);
+		if (i % 250 == 0) versions.push_back(grow.Snapshot());
+	}
+	for (size_t v = 0; v < versions.size(); v++){
+		size_t expected = v * 250 + 1;
+		assert(versions[v].Size() == expected);
+		for (size_t i = 0; i < 2000; i++){
+			assert(versions[v].Contains((i * 7919) % 2000) == (i < expected));
+		}
+	}
+	assert(grow.Size() == 2000);
+	assert(grow.GetMin() == 0);
+	assert(grow.GetMax() == 1999);
+
+	// Inner child case: 2 ends up on top with both sides black
+	PersistentRedBlackTree small;
+	small.Insert(3);
+	small.Insert(1);
+	small.Insert(2);
+	assert(small.ToInfixString() == " B1  B2  B3 ");
+	small.Insert(INT_MIN); // Longest key, and a red node
+	assert(small.ToPrefixString() == " B2  B1  R-2147483648  B3 ");
+
+	PersistentRedBlackTree empty;
+	try{
+		empty.GetMin();
+		assert(false);
+	}
+	catch(runtime_error &e){
+	}
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestFreezeThaw(){
+	cout << "Testing Freeze/Thaw..." << endl;
+	RedBlackTree empty;
+	FrozenRedBlackTree frozenEmpty = empty.Freeze();
+	int found = 0;
+	assert(frozenEmpty.Size() == 0);
+	assert(frozenEmpty.Contains(0) == false);
+	assert(frozenEmpty.LowerBound(0, found) == false);
+	try{
+		frozenEmpty.GetMin();
+		assert(false);
+	}
+	catch(runtime_error &e){
+	}
+
+	// Every size up to 40 fills the bottom level of the array differently
+	for (int n = 1; n <= 40; n++){
+		RedBlackTree rbt;
+		for (int i = 0; i < n; i++){
+			rbt.Insert(i * 3);
+		}
+		FrozenRedBlackTree frozen = rbt.Freeze();
+		assert(frozen.Size() == size_t(n));
+		assert(frozen.GetMin() == 0);
+		assert(frozen.GetMax() == (n - 1) * 3);
+		for (int key = -2; key <= n * 3 + 2; key++){
+			assert(frozen.Contains(key) == rbt.Contains(key));
+			auto it = rbt.lower_bound(key);
+			assert(frozen.LowerBound(key, found) == (it != rbt.end()));
+			if (it != rbt.end()) assert(found == *it);
+		}
+		RedBlackTree thawed = frozen.Thaw();
+		assert(vector<int>(thawed.begin(), thawed.end()) == vector<int>(rbt.begin(), rbt.end()));
+		thawed.Insert(-5);
+		assert(thawed.GetMin() == -5);
+	}
+
+	int unsorted[] = {3, 1, 2};
+	try{
+		FrozenRedBlackTree bad(begin(unsorted), end(unsorted));
+		assert(false);
+	}
+	catch(invalid_argument &e){
+	}
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestWideNodeTree(){
+	cout << "Testing Wide Node Tree..." << endl;
+	WideNodeTree wide;
+	assert(wide.Size() == 0);
+	assert(wide.Height() == 0);
+	assert(wide.Contains(5) == false);
+	try{
+		wide.GetMax();
+		assert(false);
+	}
+	catch(runtime_error &e){
+	}
+
+	// Same random keys into both engines, including the int extremes
+	RedBlackTree rbt;
+	mt19937 gen(19);
+	uniform_int_distribution<int> dist(-50000, 50000);
+	for (int i = 0; i < 20000; i++){
+		int key = dist(gen);
+		assert(wide.TryInsert(key) == rbt.TryInsert(key));
+	}
+	wide.Insert(INT_MAX);
+	wide.Insert(INT_MIN);
+	rbt.Insert(INT_MAX);
+	rbt.Insert(INT_MIN);
+	assert(wide.Size() == rbt.Size());
+	for (int key = -50010; key <= 50010; key++){
+		assert(wide.Contains(key) == rbt.Contains(key));
+	}
+	assert(wide.Contains(INT_MAX));
+	assert(wide.GetMin() == INT_MIN);
+	assert(wide.GetMax() == INT_MAX);
+	assert(wide.Height() <= 5); // log base 8 of 20000 is under 5
+
+	try{
+		wide.Insert(INT_MAX);
+		assert(false);
+	}
+	catch(invalid_argument &e){
+	}
+
+	// Ascending keys split the rightmost node every time
+	WideNodeTree ascending;
+	for (int i = 0; i < 5000; i++){
+		ascending.Insert(i);
+	}
+	assert(ascending.Size() == 5000);
+	assert(ascending.GetMin() == 0);
+	assert(ascending.GetMax() == 4999);
+	assert(ascending.Contains(2500) && !ascending.Contains(5000));
+
+	WideNodeTree moved = std::move(ascending);
+	assert(moved.Size() == 5000 && ascending.Size() == 0);
+	moved.Clear();
+	assert(moved.Contains(1) == false);
+
+	// Whichever engine IntSet is, it works the same
+	IntSet set;
+	set.Insert(2);
+	set.Insert(1);
+	assert(set.Contains(1) && set.GetMin() == 1 && set.Size() == 2);
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestSaveLoad(){
+	cout << "Testing Save/Load..." << endl;
+	const string path = "rbt-tests-snapshot.bin";
+
+	RedBlackTree rbt;
+	for (int i = 0; i < 10000; i++){
+		rbt.Insert((i * 7919) % 10007 - 5000);
+	}
+	rbt.Save(path);
+	RedBlackTree loaded = RedBlackTree::Load(path);
+	assert(loaded.Size() == rbt.Size());
+	assert(vector<int>(loaded.begin(), loaded.end()) == vector<int>(rbt.begin(), rbt.end()));
+	loaded.Insert(99999);
+	assert(loaded.GetMax() == 99999);
+
+	RedBlackTree empty;
+	empty.Save(path);
+	assert(RedBlackTree::Load(path).Size() == 0);
+
+	// Flip one key byte: the checksum has to catch it
+	rbt.Save(path);
+	{
+		fstream file(path, ios::in | ios::out | ios::binary);
+		file.seekp(100);
+		file.put(0x7f);
+	}
+	try{
+		RedBlackTree::Load(path);
+		assert(false);
+	}
+	catch(runtime_error &e){
+		assert(string(e.what()).find("checksum") != string::npos);
+	}
+
+	// Not a snapshot at all
+	{
+		ofstream file(path, ios::binary | ios::trunc);
+		file << "B10  R5  R20 and some more text";
+	}
+	try{
+		RedBlackTree::Load(path);
+		assert(false);
+	}
+	catch(runtime_error &e){
+	}
+
+	remove(path.c_str());
+	try{
+		RedBlackTree::Load(path);
+		assert(false);
+	}
+	catch(runtime_error &e){
+	}
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestStats(){
+	cout << "Testing Stats..." << endl;
+	RedBlackTree rbt;
+	for (int i = 0; i < 1000; i++){
+		rbt.Insert(i);
+	}
+	for (int i = 0; i < 1000; i += 2){
+		assert(rbt.Contains(i));
+	}
+	RedBlackTreeStats stats = rbt.Stats();
+
+	if (!RedBlackTree::STATS_ENABLED){
+		assert(stats.searches == 0 && stats.leftRotations == 0 && stats.nodeAllocations == 0);
+		cout << "PASSED! (counters off, build with -DRBT_STATS)" << endl << endl;
+		return;
+	}
+
+	// Ascending inserts only ever rotate left
+	assert(stats.nodeAllocations == 1000);
+	assert(stats.leftRotations > 0);
+	assert(stats.rightRotations == 0);
+	assert(stats.fixupRotations == stats.leftRotations);
+	assert(stats.fixupIterations == stats.fixupRecolors + stats.fixupRotations);
+	assert(stats.searches == 1000 + 500);
+	unsigned long long histogramTotal = 0;
+	for (int i = 0; i < RedBlackTreeStats::DEPTH_BUCKETS; i++){
+		histogramTotal += stats.depthHistogram[i];
+		if (i > 20) assert(stats.depthHistogram[i] == 0); // 2 * log2(1000) is the deepest a search can go
+	}
+	assert(histogramTotal == stats.searches);
+	assert(stats.depthHistogram[0] == 1); // The very first insert into an empty tree
+
+	// A copy counts its own allocations from zero
+	RedBlackTree copy(rbt);
+	assert(copy.Stats().nodeAllocations == 1000);
+	assert(copy.Stats().searches == 0);
+
+	// A set operation counts the work under its left branches too: the union
+	// of the mirrored trees rotates the other way exactly as often
+	RedBlackTree a, b, mirrorA, mirrorB;
+	for (int i = 0; i < 3000; i++){
+		int x = i * 7919 % 10007, y = i * 104729 % 10009;
+		a.TryInsert(x);
+		b.TryInsert(y);
+		mirrorA.TryInsert(-x);
+		mirrorB.TryInsert(-y);
+	}
+	RedBlackTreeStats unionStats = RedBlackTree::Union(std::move(a), std::move(b)).Stats();
+	RedBlackTreeStats mirrorStats = RedBlackTree::Union(std::move(mirrorA), std::move(mirrorB)).Stats();
+	assert(unionStats.leftRotations > 0);
+	assert(unionStats.leftRotations == mirrorStats.rightRotations);
+	assert(unionStats.rightRotations == mirrorStats.leftRotations);
+	assert(unionStats.fixupIterations == mirrorStats.fixupIterations);
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestValidate(){
+	cout << "Testing Validate..." << endl;
+	RedBlackTree empty;
+	RedBlackTreeReport report = empty.Validate();
+	assert(report.valid && report.error == "");
+	assert(report.height == 0 && report.blackHeight == 0);
+
+	// B20 with red 10 and 30 under it
+	RedBlackTree small;
+	small.Insert(10);
+	small.Insert(20);
+	small.Insert(30);
+	report = small.Validate();
+	assert(report.valid);
+	assert(report.height == 2);
+	assert(report.blackHeight == 1);
+	assert(report.averageDepth > 0.66 && report.averageDepth < 0.67);
+
+	// Lots of random inserts and removes, checked as we go
+	RedBlackTree rbt;
+	mt19937 gen(23);
+	uniform_int_distribution<int> dist(0, 5000);
+	for (int i = 0; i < 20000; i++){
+		if (i % 3 == 2){
+			rbt.Remove(dist(gen));
+		} else {
+			rbt.TryInsert(dist(gen));
+		}
+		if (i % 1000 == 0){
+			assert(rbt.Validate().valid);
+		}
+	}
+	report = rbt.Validate();
+	assert(report.valid);
+	// A red black tree is never more than twice as tall as a perfect one
+	size_t perfectHeight = 0;
+	while ((size_t(1) << perfectHeight) <= rbt.Size()) perfectHeight++;
+	assert(report.height <= 2 * perfectHeight);
+	assert(report.averageDepth < report.height);
+
+	// Everything else that builds trees has to keep them valid too
+	vector<int> sorted(100000);
+	for (int i = 0; i < 100000; i++) sorted[i] = i;
+	RedBlackTree built = RedBlackTree::BuildFromSorted(sorted.begin(), sorted.end());
+	assert(built.Validate().valid);
+	assert(RedBlackTree(built).Validate().valid);
+	auto halves = built.Split(50000);
+	assert(halves.first.Validate().valid && halves.second.Validate().valid);
+	RedBlackTree joined = RedBlackTree::Join(std::move(halves.first), 50000, std::move(halves.second));
+	assert(joined.Validate().valid && joined.Size() == 100000);
+	RedBlackTree merged = RedBlackTree::Union(std::move(joined), std::move(rbt));
+	report = merged.Validate();
+	assert(report.valid);
+	assert(report.blackHeight > 0);
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestShardedTree(){
+	cout << "Testing Sharded Tree..." << endl;
+	ShardedRedBlackTree empty(4);
+	assert(empty.ShardCount() == 4);
+	assert(empty.Size() == 0);
+	try{
+		empty.GetMin();
+		assert(false);
+	}
+	catch(runtime_error &e){
+	}
+
+	// Four threads insert their own ranges at the same time
+	ShardedRedBlackTree sharded(8);
+	vector<thread> writers;
+	for (int w = 0; w < 4; w++){
+		writers.push_back(thread([&sharded, w](){
+			for (int i = w * 5000; i < (w + 1) * 5000; i++){
+				sharded.Insert(i);
+			}
+		}));
+	}
+	for (thread &writer : writers){
+		writer.join();
+	}
+	assert(sharded.Size() == 20000);
+	assert(sharded.GetMin() == 0);
+	assert(sharded.GetMax() == 19999);
+	assert(sharded.TryInsert(123) == false);
+
+	// Batch with duplicates, both inside the batch and already in the tree
+	vector<int> batch;
+	for (int i = 19000; i < 25000; i++){
+		batch.push_back(i);
+	}
+	batch.push_back(24000);
+	assert(sharded.InsertBatch(batch) == 5000);
+	assert(sharded.Size() == 25000);
+	assert(sharded.Remove(0));
+	assert(!sharded.Remove(0));
+	assert(!sharded.Contains(0) && sharded.Contains(24999));
+	sharded.Insert(-7);
+
+	// ForEach merges the shards back into one sorted run
+	vector<int> keys;
+	sharded.ForEach([&](int key){ keys.push_back(key); });
+	assert(keys.size() == 25000);
+	assert(keys.front() == -7);
+	assert(is_sorted(keys.begin(), keys.end()));
+	assert(adjacent_find(keys.begin(), keys.end()) == keys.end());
+	cout << "PASSED!" << endl << endl;
+}
+
 int main(){
 
 	//Test with valgrind 
@@ -540,8 +2033,34 @@ int main(){
 	TestInsertBigTree();
 	TestAscendingInsert();
 	TestDescendingInsert();
+	TestHintedInsert();
 	TestExtremeValues();
 	TestInsertDuplicate();
+	TestTryInsert();
+	TestNodePool();
+	TestNodeLayout();
+	TestRemove();
+	TestWriteStreams();
+	TestRedBlackMap();
+	TestIterators();
+	TestPopMinMax();
+	TestOrderStatistics();
+	TestBuildFromSorted();
+	TestCopyAndMove();
+	TestBatchLookups();
+	TestInsertRange();
+	TestSplitJoin();
+	TestSplitJoinCycles();
+	TestSplitAcrossThreads();
+	TestSetOperations();
+	TestConcurrentReaders();
+	TestPersistentSnapshots();
+	TestFreezeThaw();
+	TestWideNodeTree();
+	TestSaveLoad();
+	TestStats();
+	TestValidate();
+	TestShardedTree();
 	
 	cout << "ALL TESTS PASSED!!" << endl;
 	return 0;
@@ -0,0 +1,145 @@
+#include "ShardedRedBlackTree.h"
+#include <stdexcept> // for exceptions
+#include <algorithm> // for sort
+#include <atomic>
+#include <exception> // for exception_ptr
+#include <system_error>
+#include <thread> // for hardware_concurrency
+
+ShardedRedBlackTree::ShardedRedBlackTree(size_t shardCount) {
+    if (shardCount == 0) {
+        shardCount = max(1u, thread::hardware_concurrency());
+    }
+    shards = vector<Shard>(shardCount);
+}
+
+// Fibonacci hashing: multiply by 2^32 / golden ratio to scramble the bits,
+// then scale the result into [0, shard count) without a division
+size_t ShardedRedBlackTree::ShardFor(int key) const {
+    uint32_t hash = uint32_t(key) * 2654435769u;
+    return size_t((uint64_t(hash) * shards.size()) >> 32);
+}
+
+vector<unique_lock<mutex>> ShardedRedBlackTree::LockAll() const {
+    vector<unique_lock<mutex>> locks;
+    locks.reserve(shards.size());
+    for (const Shard &shard : shards) {
+        locks.emplace_back(shard.lock);
+    }
+    return locks;
+}
+
+void ShardedRedBlackTree::Insert(int newData) {
+    if (!TryInsert(newData)) {
+        throw std::invalid_argument("Duplicate value insertion is not allowed.");
+    }
+}
+
+bool ShardedRedBlackTree::TryInsert(int newData) {
+    Shard &shard = shards[ShardFor(newData)];
+    lock_guard<mutex> guard(shard.lock);
+    return shard.tree.TryInsert(newData);
+}
+
+size_t ShardedRedBlackTree::InsertBatch(span<const int> keys) {
+    // Sort each shard's keys first so InsertRange can use its finger search
+    vector<vector<int>> buckets(shards.size());
+    for (int key : keys) {
+        buckets[ShardFor(key)].push_back(key);
+    }
+
+    // Workers grab shards off a shared counter until there are none left.
+    // An exception can't leave a thread, so the first one is kept, the
+    // remaining shards are skipped, and it's rethrown once everyone is done.
+    atomic<size_t> nextShard(0);
+    atomic<size_t> added(0);
+    exception_ptr failure;
+    mutex failureLock;
+    auto work = [&]() {
+        try {
+            for (size_t s = nextShard++; s < shards.size(); s = nextShard++) {
+                if (buckets[s].empty()) continue;
+                sort(buckets[s].begin(), buckets[s].end());
+                lock_guard<mutex> guard(shards[s].lock);
+                added += shards[s].tree.InsertRange(buckets[s].begin(), buckets[s].end());
+            }
+        } catch (...) {
+            lock_guard<mutex> guard(failureLock);
+            if (failure == nullptr) failure = current_exception();
+            nextShard = shards.size();
+        }
+    };
+
+    size_t workers = min<size_t>(shards.size(), max(1u, thread::hardware_concurrency()));
+    vector<thread> threads;
+    threads.reserve(workers); // A push_back that reallocated and threw would drop a running thread
+    for (size_t i = 1; i < workers; i++) {
+        try {
+            threads.push_back(thread(work));
+        } catch (const system_error &) {
+            break; // Out of threads, the ones we have (and this one) will do
+        }
+    }
+    work(); // This thread helps too
+    for (thread &t : threads) {
+        t.join();
+    }
+    if (failure != nullptr) {
+        rethrow_exception(failure);
+    }
+    return added;
+}
+
+bool ShardedRedBlackTree::Remove(int data) {
+    Shard &shard = shards[ShardFor(data)];
+    lock_guard<mutex> guard(shard.lock);
+    return shard.tree.Remove(data);
+}
+
+bool ShardedRedBlackTree::Contains(int data) const {
+    const Shard &shard = shards[ShardFor(data)];
+    lock_guard<mutex> guard(shard.lock);
+    return shard.tree.Contains(data);
+}
+
+// Every shard is locked at once so the answer is from one moment in time
+int ShardedRedBlackTree::GetMin() const {
+    vector<unique_lock<mutex>> locks = LockAll();
+    bool any = false;
+    int smallest = 0;
+    for (const Shard &shard : shards) {
+        if (shard.tree.Size() == 0) continue;
+        int candidate = shard.tree.GetMin();
+        if (!any || candidate < smallest) smallest = candidate;
+        any = true;
+    }
+    if (!any) {
+        throw std::runtime_error("Red Black Tree is empty");
+    }
+    return smallest;
+}
+
+int ShardedRedBlackTree::GetMax() const {
+    vector<unique_lock<mutex>> locks = LockAll();
+    bool any = false;
+    int largest = 0;
+    for (const Shard &shard : shards) {
+        if (shard.tree.Size() == 0) continue;
+        int candidate = shard.tree.GetMax();
+        if (!any || candidate > largest) largest = candidate;
+        any = true;
+    }
+    if (!any) {
+        throw std::runtime_error("Red Black Tree is empty");
+    }
+    return largest;
+}
+
+size_t ShardedRedBlackTree::Size() const {
+    vector<unique_lock<mutex>> locks = LockAll();
+    size_t total = 0;
+    for (const Shard &shard : shards) {
+        total += shard.tree.Size();
+    }
+    return total;
+}
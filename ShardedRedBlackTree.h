@@ -0,0 +1,92 @@
+#ifndef SHARDEDREDBLACKTREE_H
+#define SHARDEDREDBLACKTREE_H
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <span>
+#include <utility>
+#include <vector>
+#include "RedBlackTree.h"
+
+using namespace std;
+
+// Int set split over several independent RedBlackTrees (shards) so inserts
+// from many threads don't all wait on one lock.
+//
+// Each key always goes to the same shard, picked by hashing it, so keys that
+// arrive in order still spread evenly. Every shard has its own mutex and sits
+// on its own cache lines, so threads working on different shards never touch
+// the same memory. Anything that needs the whole set (GetMin, GetMax, Size,
+// ForEach) asks every shard; ForEach merges the shards back into key order.
+class ShardedRedBlackTree {
+
+	public:
+		// One shard per hardware thread by default
+		explicit ShardedRedBlackTree(size_t shardCount = 0);
+		ShardedRedBlackTree(const ShardedRedBlackTree &) = delete;
+		ShardedRedBlackTree &operator=(const ShardedRedBlackTree &) = delete;
+
+		void Insert(int newData);
+		bool TryInsert(int newData);
+		// Spreads keys over the shards and fills them in parallel, one thread
+		// per shard at most. Duplicates are skipped; returns how many went in.
+		// The threads are started on every call, so small batches are better
+		// off with TryInsert. If a shard's insert throws, the shards already
+		// filled keep their keys and the exception comes out after the threads
+		// are joined.
+		size_t InsertBatch(span<const int> keys);
+		bool Remove(int data);
+		bool Contains(int data) const;
+
+		int GetMin() const;
+		int GetMax() const;
+		size_t Size() const;
+		size_t ShardCount() const { return shards.size(); }
+
+		// Calls visit(key) on every key in ascending order by merging the
+		// shards. Holds every shard's lock the whole time, so writers wait.
+		template <typename Visitor>
+		void ForEach(Visitor visit) const;
+
+	private:
+		// 64 bytes is the cache line size on the machines we care about
+		struct alignas(64) Shard {
+			mutable mutex lock;
+			RedBlackTree tree;
+		};
+
+		vector<Shard> shards;
+
+		size_t ShardFor(int key) const;
+		// Locks every shard, always in the same order so two callers can't deadlock
+		vector<unique_lock<mutex>> LockAll() const;
+};
+
+template <typename Visitor>
+void ShardedRedBlackTree::ForEach(Visitor visit) const {
+	vector<unique_lock<mutex>> locks = LockAll();
+
+	// Smallest unvisited key of every shard on a min-heap; take the top and
+	// put that shard's next key in its place
+	typedef pair<int, size_t> Head; // key, shard
+	vector<RedBlackTree::Iterator> next;
+	priority_queue<Head, vector<Head>, greater<Head>> heads;
+	for (size_t s = 0; s < shards.size(); s++) {
+		next.push_back(shards[s].tree.begin());
+		if (next[s] != shards[s].tree.end()) {
+			heads.push(Head(*next[s], s));
+		}
+	}
+	while (!heads.empty()) {
+		size_t s = heads.top().second;
+		heads.pop();
+		visit(*next[s]);
+		if (++next[s] != shards[s].tree.end()) {
+			heads.push(Head(*next[s], s));
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,183 @@
+#include "WideNodeTree.h"
+#include <stdexcept> // for exceptions
+#include <utility> // for swap
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+WideNodeTree::WideNodeTree(WideNodeTree &&other) noexcept
+    : numItems(other.numItems), root(other.root), pool(std::move(other.pool)) {
+    other.numItems = 0;
+    other.root = nullptr;
+}
+
+WideNodeTree &WideNodeTree::operator=(WideNodeTree &&other) noexcept {
+    if (this != &other) {
+        Clear();
+        swap(numItems, other.numItems);
+        swap(root, other.root);
+        pool = std::move(other.pool);
+    }
+    return *this;
+}
+
+// Nodes are trivially destructible, so the pool can just drop its slabs
+void WideNodeTree::Clear() {
+    pool.Release();
+    root = nullptr;
+    numItems = 0;
+}
+
+// How many keys in node are < data, which is also the child to go down into.
+// Always looks at all 16 slots: comparing them all at once is cheaper than
+// stopping early.
+int WideNodeTree::CountLess(const WideNode *node, int data) {
+#if defined(__AVX2__)
+    __m256i probe = _mm256_set1_epi32(data);
+    __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(node->keys));
+    __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(node->keys + 8));
+    unsigned int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(probe, low)))
+                      | _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(probe, high))) << 8;
+    return __builtin_popcount(mask);
+#elif defined(__SSE2__)
+    __m128i probe = _mm_set1_epi32(data);
+    unsigned int mask = 0;
+    for (int i = 0; i < NODE_SLOTS; i += 4) {
+        __m128i keys = _mm_loadu_si128(reinterpret_cast<const __m128i *>(node->keys + i));
+        mask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(probe, keys))) << i;
+    }
+    return __builtin_popcount(mask);
+#else
+    int i = 0;
+    while (i < node->count && node->keys[i] < data) {
+        i++;
+    }
+    return i;
+#endif
+}
+
+bool WideNodeTree::Contains(int data) const {
+    const WideNode *node = root;
+    while (node != nullptr) {
+        int i = CountLess(node, data);
+        if (i < node->count && node->keys[i] == data) {
+            return true;
+        }
+        node = node->leaf ? nullptr : node->children[i];
+    }
+    return false;
+}
+
+int WideNodeTree::GetMin() const {
+    if (root == nullptr) {
+        throw std::runtime_error("Red Black Tree is empty");
+    }
+    const WideNode *node = root;
+    while (!node->leaf) node = node->children[0];
+    return node->keys[0];
+}
+
+int WideNodeTree::GetMax() const {
+    if (root == nullptr) {
+        throw std::runtime_error("Red Black Tree is empty");
+    }
+    const WideNode *node = root;
+    while (!node->leaf) node = node->children[node->count];
+    return node->keys[node->count - 1];
+}
+
+int WideNodeTree::Height() const {
+    int height = 0;
+    for (const WideNode *node = root; node != nullptr; node = node->leaf ? nullptr : node->children[0]) {
+        height++;
+    }
+    return height;
+}
+
+void WideNodeTree::Insert(int newData) {
+    if (!TryInsert(newData)) {
+        throw std::invalid_argument("Duplicate value insertion is not allowed.");
+    }
+}
+
+// Goes down once, splitting any full node on the way, so there's always room
+// for a key coming up from below and nothing ever has to walk back up
+bool WideNodeTree::TryInsert(int newData) {
+    if (root == nullptr) {
+        root = NewNode(true);
+    } else if (root->count == MAX_KEYS) {
+        WideNode *oldRoot = root;
+        root = NewNode(false);
+        root->children[0] = oldRoot;
+        SplitChild(root, 0);
+    }
+
+    WideNode *node = root;
+    while (true) {
+        int i = CountLess(node, newData);
+        if (i < node->count && node->keys[i] == newData) {
+            return false;
+        }
+        if (node->leaf) {
+            InsertAt(node, i, newData, nullptr);
+            numItems++;
+            return true;
+        }
+        if (node->children[i]->count == MAX_KEYS) {
+            SplitChild(node, i);
+            // The middle key just came up to keys[i]; see which half to go into
+            if (newData == node->keys[i]) {
+                return false;
+            }
+            if (newData > node->keys[i]) {
+                i++;
+            }
+        }
+        node = node->children[i];
+    }
+}
+
+WideNodeTree::WideNode *WideNodeTree::NewNode(bool leaf) {
+    WideNode *node = new (pool.Allocate()) WideNode();
+    node->leaf = leaf;
+    return node;
+}
+
+// Splits the full child parent->children[i] in two around its middle key,
+// which moves up into parent (that always has room)
+void WideNodeTree::SplitChild(WideNode *parent, int i) {
+    WideNode *left = parent->children[i];
+    WideNode *right = NewNode(left->leaf);
+    int middle = left->keys[SPLIT_AT];
+
+    right->count = MAX_KEYS - SPLIT_AT - 1;
+    for (int k = 0; k < right->count; k++) {
+        right->keys[k] = left->keys[SPLIT_AT + 1 + k];
+    }
+    if (!left->leaf) {
+        for (int k = 0; k <= right->count; k++) {
+            right->children[k] = left->children[SPLIT_AT + 1 + k];
+        }
+    }
+    for (int k = SPLIT_AT; k < MAX_KEYS; k++) {
+        left->keys[k] = INT_MAX; // Back to padding so CountLess ignores them
+    }
+    left->count = SPLIT_AT;
+
+    InsertAt(parent, i, middle, right);
+}
+
+// Puts key at keys[i] (and rightChild just right of it), shifting the rest over
+void WideNodeTree::InsertAt(WideNode *node, int i, int key, WideNode *rightChild) {
+    for (int k = node->count; k > i; k--) {
+        node->keys[k] = node->keys[k - 1];
+    }
+    node->keys[i] = key;
+    if (!node->leaf) {
+        for (int k = node->count + 1; k > i + 1; k--) {
+            node->children[k] = node->children[k - 1];
+        }
+        node->children[i + 1] = rightChild;
+    }
+    node->count++;
+}
@@ -0,0 +1,77 @@
+#ifndef WIDENODETREE_H
+#define WIDENODETREE_H
+
+#include <climits>
+#include <cstddef>
+#include "NodePool.h"
+#include "RedBlackTree.h"
+
+using namespace std;
+
+// Int set with up to 15 keys per node (a B-tree), behind the same
+// Insert/TryInsert/Contains/GetMin/GetMax/Size interface as RedBlackTree.
+//
+// A lookup visits about log16(n) nodes instead of log2(n), and inside a node
+// the probe is compared against all 16 key slots at once with SIMD (AVX2 if
+// the compiler targets it, otherwise SSE2, otherwise a plain loop). Unused
+// slots hold INT_MAX so they never count as smaller than the probe.
+//
+// There's no Remove yet; it's meant for insert-then-query workloads.
+class WideNodeTree {
+
+	public:
+		WideNodeTree() {}
+		WideNodeTree(const WideNodeTree &) = delete;
+		WideNodeTree &operator=(const WideNodeTree &) = delete;
+		WideNodeTree(WideNodeTree &&other) noexcept;
+		WideNodeTree &operator=(WideNodeTree &&other) noexcept;
+
+		void Insert(int newData);
+		// Same as Insert but returns false on a duplicate instead of throwing
+		bool TryInsert(int newData);
+		bool Contains(int data) const;
+		int GetMin() const;
+		int GetMax() const;
+		size_t Size() const { return numItems; }
+		void Clear();
+
+		// Levels from the root down to the leaves (0 if empty)
+		int Height() const;
+
+	private:
+		static const int NODE_SLOTS = 16;
+		static const int MAX_KEYS = NODE_SLOTS - 1; // a full node splits around keys[7]
+		static const int SPLIT_AT = MAX_KEYS / 2;
+
+		struct WideNode {
+			alignas(64) int keys[NODE_SLOTS];
+			WideNode *children[NODE_SLOTS + 1];
+			int count = 0;
+			bool leaf = true;
+
+			WideNode() {
+				for (int &key : keys) key = INT_MAX;
+			}
+		};
+
+		size_t numItems = 0;
+		WideNode *root = nullptr;
+		BasicNodePool<WideNode> pool;
+
+		static int CountLess(const WideNode *node, int data);
+		WideNode *NewNode(bool leaf);
+		void SplitChild(WideNode *parent, int i);
+		static void InsertAt(WideNode *node, int i, int key, WideNode *rightChild);
+};
+
+// Pick the engine at compile time: -DRBT_USE_WIDE_NODES swaps every IntSet
+// over to the wide node tree so the two can be benchmarked against each other
+#ifdef RBT_USE_WIDE_NODES
+typedef WideNodeTree IntSet;
+const char *const INT_SET_NAME = "WideNodeTree";
+#else
+typedef RedBlackTree IntSet;
+const char *const INT_SET_NAME = "RedBlackTree";
+#endif
+
+#endif